@@ -82,7 +82,7 @@ PsgMute:
 
 * clear Genesis RAM
         lea     _end_dirty,%a0
-        move.w  #0x3FFE,%d1
+        move.w  #_ram_clear_longs,%d1
 
 ClearRam:
         move.l  %d0,(%a0)+
@@ -187,8 +187,8 @@ boot_addr:
 * Release Z80 bus
 	move.b %d0, (%a1)
 
-* Clear WRAM (skip dirty DW)
-	move.w  #0x3FFE,%d1
+* Clear WRAM (skip dirty area)
+	move.w  #_ram_clear_longs,%d1
 	lea     _end_dirty,%a0
 WRamClear:
 	move.l  %d0,(a0)+
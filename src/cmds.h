@@ -29,6 +29,11 @@ enum {
 	WF_CMD_RUN,			///< Run from address
 	WF_CMD_AUTORUN,			///< Run from entry point in cart header
 	WF_CMD_BLOADER_START,		///< Get bootloader start address
+	WF_CMD_STAGE,			///< Stage data in WiFi module flash
+	WF_CMD_PROF_GET,		///< Get loop profiling data
+	WF_CMD_MEM_GET,			///< Get memory pool statistics
+	WF_CMD_BLANK_CHECK,		///< Find first non blank byte in range
+	WF_CMD_CHECKSUM,		///< 16-bit word sum of range
 	WF_CMD_MAX			///< Maximum command value delimiter
 };
 
@@ -1,6 +1,8 @@
 #include <string.h>
 #include "flash.h"
 #include "util.h"
+#include "loop.h"
+#include "ovl.h"
 
 #include "vdp.h"
 
@@ -18,7 +20,7 @@
 /// Sector addresses, shifted FLASH_SADDR_SHIFTS times to the right
 /// Note not all the sectors are the same length (depending on top boot
 /// or bottom boot flash configuration).
-static const uint16_t saddr[] = {
+static const uint16_t saddr[] FS_RO(saddr) = {
 	0x0000, 0x0100, 0x0200, 0x0300, 0x0400, 0x0500, 0x0600, 0x0700,
 	0x0800, 0x0900, 0x0A00, 0x0B00, 0x0C00, 0x0D00, 0x0E00, 0x0F00,
 	0x1000, 0x1100, 0x1200, 0x1300, 0x1400, 0x1500, 0x1600, 0x1700,
@@ -59,6 +61,18 @@ struct poll_data {
 
 static struct poll_data poll;
 
+// Loop callbacks running from ROM are delayed while an embedded operation is
+// in progress, and the flash overlay must stay loaded.
+FS_T(busy_set)
+static void busy_set(enum poll_type type)
+{
+	if (!poll.type) {
+		loop_rom_lock(TRUE);
+		ovl_pin(TRUE);
+	}
+	poll.type = type;
+}
+
 /// Returns the sector number corresponding to address input
 #define FLASH_NSECT		(sizeof(saddr) / sizeof(uint16_t))
 
@@ -241,9 +255,9 @@ void flash_chip_erase(void *ctx)
 	uint8_t i;
 
 	// Unlock and write chip erase sequence
+	busy_set(FLASH_POLL_CHIP);
 	FlashUnlock();
 	FLASH_WRITE_CMD(FLASH_CHIP_ERASE, i);
-	poll.type = FLASH_POLL_CHIP;
 	poll.addr = 1;
 	poll.data = 0xFF;
 	poll.ctx = ctx;
@@ -260,16 +274,17 @@ void flash_sector_erase(uint32_t addr, void *ctx)
 	// Obtain the sector address
 	sa = FLASH_SA_GET(addr);
 	// Unlock and write sector address erase sequence
+	busy_set(FLASH_POLL_SECT);
 	FlashUnlock();
 	FLASH_WRITE_CMD(FLASH_SEC_ERASE, i);
 	// Write sector address 
 	FlashWrite(sa, FLASH_SEC_ERASE_WR[0]);
-	poll.type = FLASH_POLL_SECT;
 	poll.addr = addr;
 	poll.data = 0xFF;
 	poll.ctx = ctx;
 }
 
+FS_T(range_erase_cb)
 static void range_erase_cb(int err, void *ctx)
 {
 	if (err) {
@@ -319,7 +334,6 @@ int flash_range_erase(uint32_t addr, uint32_t len)
 	} else {
 		ctx = poll.cb;
 		poll.cb = range_erase_cb;
-		poll.type = FLASH_POLL_SECT;
 		// Store end sector address
 		poll.cur_sect = end;
 		poll.fin_sect = start;
@@ -346,6 +360,7 @@ int flash_write_buf(uint32_t addr, uint16_t *data, uint16_t wlen, void *ctx)
 	wc = MIN(wlen, FLASH_CHIP_WBUFLEN - ((addr>>1) &
 				(FLASH_CHIP_WBUFLEN - 1))) - 1;
 	// Unlock and send Write to Buffer command
+	busy_set(FLASH_POLL_DATA);
 	FlashUnlock();
 	FlashWriteW(sa, FLASH_WR_BUF[0]);
 	// Write word count - 1
@@ -355,7 +370,6 @@ int flash_write_buf(uint32_t addr, uint16_t *data, uint16_t wlen, void *ctx)
 	for (i = 0; i <= wc; i++, addr+=2) FlashWriteW(addr, data[i]);
 	// Write program buffer command
 	FlashWriteW(sa, FLASH_PRG_BUF[0]);
-	poll.type = FLASH_POLL_DATA;
 	poll.addr = addr - 1;
 	poll.data = data[i - 1];
 	poll.ctx = ctx;
@@ -364,6 +378,7 @@ int flash_write_buf(uint32_t addr, uint16_t *data, uint16_t wlen, void *ctx)
 	return i;
 }
 
+FS_T(write_long_cb)
 static void flash_write_long_cb(int err, void *ctx)
 {
 	int written;
@@ -446,11 +461,18 @@ void flash_poll_proc(void)
 
 complete:
 	poll.type = FLASH_POLL_NONE;
+	loop_rom_lock(FALSE);
+	ovl_pin(FALSE);
 	if (poll.cb) {
 		poll.cb(err, poll.ctx);
 	}
 }
 
+int flash_busy(void)
+{
+	return poll.type != FLASH_POLL_NONE;
+}
+
 void flash_completion_cb_set(completion_cb cb)
 {
 	poll.cb = cb;
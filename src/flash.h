@@ -2,6 +2,9 @@
  * \brief This module allows to manage (mainly read and write) from flash
  * memory chips such as S29GL032.
  *
+ * Functions and data marked with FS_T() and FS_RO() are placed in the flash
+ * overlay, call ovl_load(OVL_FLASH) before using them (see ovl.h).
+ *
  * \author Jesús Alonso (doragasu)
  * \date   2015
  * \defgroup flash flash
@@ -352,6 +355,7 @@ uint8_t FlashSectErase(uint32_t addr);
  * \param[in] len  Length of the range to erase
  * \return '0' if the erase operation completed successfully, '1' otherwise.
  ****************************************************************************/
+FS_T(RangeErase)
 uint8_t FlashRangeErase(uint32_t addr, uint32_t len);
 
 /************************************************************************//**
@@ -400,6 +404,14 @@ void flash_poll_proc(void);
 FS_T(write_long)
 int flash_write_long(uint32_t addr, uint16_t *data, uint16_t wlen);
 
+/************************************************************************//**
+ * \brief Check if an asynchronous erase/program operation is in progress.
+ *
+ * \return TRUE while the flash chip cannot be read, FALSE otherwise.
+ * \note Resident, can be called when the flash overlay is not loaded.
+ ****************************************************************************/
+int flash_busy(void);
+
 void flash_completion_cb_set(completion_cb cb);
 
 #ifdef __cplusplus
@@ -19,7 +19,8 @@ static void scroll_cb(struct loop_timer *t)
 static struct loop_timer scroll_timer = {
 	.timer_cb = scroll_cb,
 	.frames = 2,
-	.auto_reload = TRUE
+	.auto_reload = TRUE,
+	.phase_mode = LOOP_PHASE_AUTO
 };
 
 void bg_init(void)
@@ -59,13 +60,14 @@ void bg_led_draw(uint16_t plane_addr, uint8_t plane_width, uint8_t x, uint8_t y,
 {
 	uint16_t offset = plane_addr + 2 * (x + plane_width * y);
 	uint16_t tile_addr = 3 * FONT_NCHARS + LOGO_NUM_TILES;
+	uint16_t cells[2];
 
-	VdpRamRwPrep(VDP_VRAM_WR, offset);
-	VDP_DATA_PORT_W = tile_addr + (pal<<13);
-	VDP_DATA_PORT_W = tile_addr++ + (pal<<13) + (1<<11);
+	cells[0] = tile_addr + (pal<<13);
+	cells[1] = tile_addr++ + (pal<<13) + (1<<11);
+	VdpCellsWrite(offset, cells, 2);
 	offset += 2 * plane_width;
-	VdpRamRwPrep(VDP_VRAM_WR, offset);
-	VDP_DATA_PORT_W = tile_addr + (pal<<13);
-	VDP_DATA_PORT_W = tile_addr + (pal<<13) + (1<<11);
+	cells[0] = tile_addr + (pal<<13);
+	cells[1] = tile_addr + (pal<<13) + (1<<11);
+	VdpCellsWrite(offset, cells, 2);
 }
 
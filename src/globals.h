@@ -11,12 +11,21 @@
 /// the cartridge header
 #define GL_ENTRY_POINT_ADDR	(*((uint32_t*)GL_NOTES_ENTRY_POINT))
 
+/// Evaluates to TRUE if there is a program installed (valid entry point)
+#define GL_ENTRY_POINT_VALID()	(GL_ENTRY_POINT_ADDR &&			\
+		0xFFFFFFFF != GL_ENTRY_POINT_ADDR &&			\
+		0x20202020 != GL_ENTRY_POINT_ADDR)
+
 /// Bootloader address is currently the 68000 start entry
 #define GL_BOOTLOADER_ADDR	(*((uint32_t*)0x000004))
 
 /// Maximum program length is 4 Megabyte minus a 64 KiB sector
 #define GL_PROG_LEN_MAX		(4 * 1024 - 64) * 1024
 
+/// WiFi module flash address of the AP association cache. Address 0 as seen
+/// by mw_flash_*() functions, is 0x80000 in the module flash chip.
+#define GL_MW_FLASH_AP_CACHE_ADDR	0x37F000
+
 /// Major version
 #define GL_VER_MAJOR	1
 
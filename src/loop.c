@@ -1,34 +1,82 @@
-/// \todo
-/// * Frame number masking for triggering timers on different frames
-///   (e.g. on even or odd frames).
-
 #include <string.h>
 #include <setjmp.h>
 #include "loop.h"
 #include "mpool.h"
 #include "vdp.h"
+#include "util.h"
 
 enum loop_check {
 	LOOP_CHECK_FUNCS = 0,
 	LOOP_CHECK_TIMERS
 };
 
+/// Mask to get the timer wheel slot from the expiration frame
+#define LOOP_WHEEL_MASK		(LOOP_WHEEL_SLOTS - 1)
+
 struct pend_env {
 	struct loop_func *f;
 	struct loop_timer *t;
 };
 
+/// Task (coroutine) used to run callbacks with the task flag set
+struct loop_task {
+	jmp_buf ctx;		///< Context saved when switching out
+	struct loop_task *next;	///< Next task in free, ready or wait list
+	struct loop_func *f;	///< Function run by the task
+	struct loop_timer *t;	///< Timer run by the task
+	uint8_t *stack_top;	///< Top of the task stack
+	int value;		///< Value passed to loop_wake()
+	uint8_t started;	///< Task is running task_main()
+};
+
 struct loop_data {
-	struct loop_func **f;
-	struct loop_timer **t;
+	/// Function lists, one per priority class
+	struct loop_func *f_head[LOOP_PRIO_MAX];
+	struct loop_func *f_tail[LOOP_PRIO_MAX];
+	/// Next function to run on each priority class
+	struct loop_func *f_next[LOOP_PRIO_MAX];
+	/// Function being run
+	struct loop_func *f_run;
+	/// Timer wheel, timers are stored in the slot of their expiry frame
+	struct loop_timer *wheel[LOOP_WHEEL_SLOTS];
+	/// Next timer to check in current wheel slot
+	struct loop_timer *t_next;
+	/// Timer being run
+	struct loop_timer *t_run;
 	struct pend_env *env;
+	/// Innermost nested wait context, and the object it waits on
 	jmp_buf *jmp;
+	struct loop_wait *jmp_wait;
+	/// Context to return to when tasks switch out
+	jmp_buf sched;
+	/// Task currently running, NULL when not in a task
+	struct loop_task *task;
+	/// Tasks not running any callback
+	struct loop_task *task_free;
+	/// Tasks ready to be resumed
+	struct loop_task *ready_head;
+	struct loop_task *ready_tail;
+	/// Wait object for loop_pend() and loop_post()
+	struct loop_wait pend;
+	/// Wake of a nested wait from a task, deferred until the task switches
+	/// out
+	int post;
 	enum loop_check check;
-	int8_t func_max;
-	int8_t timer_max;
-	int8_t idx;
+	uint8_t func_max;
+	uint8_t timer_max;
+	uint8_t funcs;
+	uint8_t timers;
 	int8_t vblank;
+	/// V counter read on the last frame_update() call
+	uint8_t vcount;
+	/// A function callback ran during the last pass
+	uint8_t busy;
+	/// ROM cannot be read, callbacks with the rom flag are delayed
+	uint8_t rom_locked;
+	/// Last processed frame
 	uint16_t frame;
+	/// Frames missed, because a callback ran for too long
+	uint16_t dropped;
 	int exit;
 };
 
@@ -45,11 +93,6 @@ int loop_init(uint8_t max_func, uint8_t max_timer)
 
 	d = mp_alloc(sizeof(struct loop_data));
 	memset(d, 0, sizeof(struct loop_data));
-	// Allocate pointers for the func/timer structures
-	d->f = mp_alloc(max_func  * sizeof(struct loop_func*));
-	d->t = mp_alloc(max_timer * sizeof(struct loop_timer*));
-	memset(d->f, 0, max_func  * sizeof(struct loop_func*));
-	memset(d->t, 0, max_timer * sizeof(struct loop_timer*));
 	d->func_max = max_func;
 	d->timer_max = max_timer;
 	d->vblank = VDP_CTRL_PORT_W & VDP_STAT_VBLANK;
@@ -57,174 +100,640 @@ int loop_init(uint8_t max_func, uint8_t max_timer)
 	return 0;
 }
 
-int loop_func_add(struct loop_func *func)
+int loop_task_pool_init(uint8_t tasks, uint16_t stack_len)
 {
-	int i;
+	struct loop_task *t;
+	uint8_t *stack;
 
-	for (i = 0; i < d->func_max && d->f[i]; i++) {
-		// If function was marked to be deleted, just remove the flag
-		if (d->f[i] == func && func->to_delete) {
-			func->to_delete = 0;
-			return 0;
+	t = mp_calloc(tasks * sizeof(struct loop_task));
+	if (!t) {
+		return 1;
+	}
+	stack_len &= ~(MP_ALIGN - 1);
+	for (; tasks; tasks--, t++) {
+		stack = mp_alloc(stack_len);
+		if (!stack) {
+			return 1;
 		}
+		t->stack_top = stack + stack_len;
+		t->next = d->task_free;
+		d->task_free = t;
 	}
-	if (i == d->func_max) {
+
+	return 0;
+}
+
+int loop_func_add(struct loop_func *func)
+{
+	if (func->linked) {
+		return 0;
+	}
+	if (d->funcs >= d->func_max) {
 		return 1;
 	}
 
-	d->f[i] = func;
+	func->next = NULL;
+	func->prev = d->f_tail[func->prio];
+	if (func->prev) {
+		func->prev->next = func;
+	} else {
+		d->f_head[func->prio] = func;
+	}
+	d->f_tail[func->prio] = func;
+	func->linked = 1;
+	d->funcs++;
+
 	return 0;
 }
 
 int loop_func_del(struct loop_func *func)
 {
-	struct loop_func *f;
-	int i;
+	if (!func->linked) {
+		return 1;
+	}
+
+	// Do not break an iteration in progress
+	if (d->f_next[func->prio] == func) {
+		d->f_next[func->prio] = func->next;
+	}
+	if (func->prev) {
+		func->prev->next = func->next;
+	} else {
+		d->f_head[func->prio] = func->next;
+	}
+	if (func->next) {
+		func->next->prev = func->prev;
+	} else {
+		d->f_tail[func->prio] = func->prev;
+	}
+	func->next = func->prev = NULL;
+	func->linked = 0;
+	d->funcs--;
 
-	for (i = 0; (f = d->f[i]); i++) {
-		if (f == func) {
-			// Mark function to be deleted during loop
-			f->to_delete = 1;
-			return 0;
+	return 0;
+}
+
+static void timer_unlink(struct loop_timer *t)
+{
+	// Do not break an iteration in progress
+	if (d->t_next == t) {
+		d->t_next = t->next;
+	}
+	if (t->prev) {
+		t->prev->next = t->next;
+	} else {
+		d->wheel[t->expiry & LOOP_WHEEL_MASK] = t->next;
+	}
+	if (t->next) {
+		t->next->prev = t->prev;
+	}
+	t->next = t->prev = NULL;
+	t->linked = 0;
+}
+
+static void timer_link(struct loop_timer *t, uint16_t expiry)
+{
+	struct loop_timer **slot = &d->wheel[expiry & LOOP_WHEEL_MASK];
+
+	if (t->linked) {
+		timer_unlink(t);
+	}
+	// Insert at slot head, so an iteration in progress skips it
+	t->expiry = expiry;
+	t->prev = NULL;
+	t->next = *slot;
+	if (*slot) {
+		(*slot)->prev = t;
+	}
+	*slot = t;
+	t->linked = 1;
+}
+
+// First frame not before from, matching the timer phase
+static uint16_t phase_expiry(const struct loop_timer *t, uint16_t from)
+{
+	uint16_t pos = from % t->frames;
+	uint16_t phase = t->phase % t->frames;
+
+	if (phase < pos) {
+		phase += t->frames;
+	}
+
+	return from + phase - pos;
+}
+
+// Number of timers firing on each frame, starting on frame from
+static void phase_load_get(uint8_t *load, uint16_t from)
+{
+	struct loop_timer *t;
+	int16_t pos;
+	uint8_t i;
+
+	memset(load, 0, LOOP_PHASE_HORIZON);
+	for (i = 0; i < LOOP_WHEEL_SLOTS; i++) {
+		for (t = d->wheel[i]; t; t = t->next) {
+			pos = t->expiry - from;
+			if (t->auto_reload && pos < 0) {
+				pos += ((t->frames - 1 - pos) / t->frames) *
+					t->frames;
+			}
+			while (pos >= 0 && pos < LOOP_PHASE_HORIZON) {
+				load[pos]++;
+				if (!t->auto_reload) {
+					break;
+				}
+				pos += t->frames;
+			}
 		}
 	}
-	return 1;
 }
 
-int loop_timer_add(struct loop_timer *timer)
+// Choose the first expiration with less load on the frames it fires
+static uint16_t phase_auto_expiry(struct loop_timer *t, uint16_t from)
 {
-	int i;
+	uint8_t load[LOOP_PHASE_HORIZON];
+	uint16_t best_cost = 0xFFFF;
+	uint16_t cost;
+	uint8_t best = 0;
+	uint8_t offset;
+	uint16_t i;
+	uint8_t candidates = MIN(t->frames, LOOP_PHASE_HORIZON);
+
+	phase_load_get(load, from);
+	for (offset = 0; offset < candidates; offset++) {
+		cost = 0;
+		for (i = offset; i < LOOP_PHASE_HORIZON; i += t->frames) {
+			cost += load[i];
+			if (!t->auto_reload) {
+				break;
+			}
+		}
+		if (cost < best_cost) {
+			best_cost = cost;
+			best = offset;
+		}
+	}
+	t->phase = (uint16_t)(from + best) % t->frames;
+
+	return from + best;
+}
+
+void loop_timer_sched(struct loop_timer *timer)
+{
+	uint16_t expiry;
 
-	for (i = 0; i < d->timer_max && d->t[i]; i++) {
-		// If timer was marked to be deleted, just remove the flag
-		if (d->t[i] == timer && timer->to_delete) {
-			timer->to_delete = 0;
-			return 0;
+	if (timer->added && timer->frames) {
+		if (timer->linked) {
+			// Do not count the timer load when choosing the phase
+			timer_unlink(timer);
+		}
+		expiry = d->frame + timer->frames;
+		if (LOOP_PHASE_FIXED == timer->phase_mode) {
+			expiry = phase_expiry(timer, expiry);
+		} else if (LOOP_PHASE_AUTO == timer->phase_mode) {
+			expiry = phase_auto_expiry(timer, expiry);
 		}
+		timer_link(timer, expiry);
+	} else if (timer->linked) {
+		timer_unlink(timer);
 	}
-	if (i == d->timer_max) {
+}
+
+int loop_timer_add(struct loop_timer *timer)
+{
+	if (timer->added) {
+		return 0;
+	}
+	if (d->timers >= d->timer_max) {
 		return 1;
 	}
 
-	d->t[i] = timer;
+	timer->added = 1;
+	timer->linked = 0;
+	d->timers++;
+	loop_timer_sched(timer);
+
 	return 0;
 }
 
 int loop_timer_del(struct loop_timer *timer)
 {
-	struct loop_timer *t;
-	int i;
+	if (!timer->added) {
+		return 1;
+	}
 
-	for (i = 0; (t = d->t[i]); i++) {
-		if (t == timer) {
-			// Mark function to be deleted during loop
-			t->to_delete = 1;
-			return 0;
-		}
+	if (timer->linked) {
+		timer_unlink(timer);
 	}
-	return 1;
+	timer->added = 0;
+	d->timers--;
+
+	return 0;
 }
 
+// Frames are counted by polling the VDP status, interrupts are not used
+// because the vectors live in the flash chip (erased when flashing a ROM).
+// If a callback hides a whole VBlank period, the V counter is lower than
+// on the previous call while still in active display: count the frame as
+// missed, and advance one frame so timers catch up.
 static int frame_update(void)
 {
 	int vblank = VDP_CTRL_PORT_W & VDP_STAT_VBLANK;
+	uint8_t vcount = VDP_HV_COUNT_W>>8;
 	int rc = 0;
 
 	if (!d->vblank && vblank) {
 		rc = 1;
-		d->frame++;
+	} else if (!d->vblank && !vblank && vcount < d->vcount) {
+		d->dropped++;
+		rc = 1;
 	}
 	d->vblank = vblank;
+	d->vcount = vcount;
+	d->frame += rc;
+
 	return rc;
 }
 
-static void delete_func(int i)
+#ifdef LOOP_PROFILE
+/// 68000 cycles per scanline (3420 master clocks / 7)
+#define PROF_LINE_CYCLES	488
+/// H counter values per scanline (H40 mode)
+#define PROF_H_STEPS		210
+/// Last H counter value before the counter jumps (H40 mode)
+#define PROF_H_JUMP_FROM	0xB6
+/// H counter value after the jump (H40 mode)
+#define PROF_H_JUMP_TO		0xE4
+/// V counter value at the start of VBlank (V28 mode)
+#define PROF_VBLANK_LINE	0xE0
+
+struct prof_stamp {
+	uint32_t cycles;	///< Cycles since VBlank start
+	uint8_t active;		///< Taken during active display
+};
+
+static uint16_t prof_frame_lines(void)
 {
-	while (d->f[i + 1]) {
-		d->f[i] = d->f[i + 1];
-		i++;
+	return VdpIs60Hz() ? 262 : 313;
+}
+
+// Frames start at VBlank, since that is when the loop counts them.
+// Timestamps taken during the V counter jump in VBlank are approximate.
+static void prof_stamp(struct prof_stamp *stamp)
+{
+	uint16_t hv = VDP_HV_COUNT_W;
+	uint8_t v, h;
+	uint16_t line;
+
+	v = hv>>8;
+	h = hv;
+	stamp->active = v < PROF_VBLANK_LINE;
+	if (!stamp->active) {
+		line = v - PROF_VBLANK_LINE;
+	} else {
+		line = v + prof_frame_lines() - PROF_VBLANK_LINE;
+	}
+	if (h > PROF_H_JUMP_FROM) {
+		h -= PROF_H_JUMP_TO - PROF_H_JUMP_FROM - 1;
 	}
-	d->f[i] = NULL;
+	stamp->cycles = (uint32_t)line * PROF_LINE_CYCLES +
+		(uint16_t)h * PROF_LINE_CYCLES / PROF_H_STEPS;
 }
 
-static void run_funcs(void)
+// There is no frame counter running while a callback runs, so run times are
+// measured modulo one frame. A run that starts and ends in active display
+// with the frame position wrapped hid a whole VBlank period from the loop:
+// it is counted as an overrun, like frame_update() counts a dropped frame.
+static void prof_update(struct loop_prof *prof, const struct prof_stamp *start)
+{
+	struct prof_stamp end;
+	uint32_t frame_cycles = (uint32_t)prof_frame_lines() * PROF_LINE_CYCLES;
+	int32_t cycles;
+	int wrapped;
+
+	prof_stamp(&end);
+	cycles = end.cycles - start->cycles;
+	wrapped = cycles < 0;
+	if (wrapped) {
+		cycles += frame_cycles;
+	}
+
+	if (!prof->runs) {
+		prof->min = prof->max = prof->avg = cycles;
+	} else {
+		prof->min = MIN(prof->min, (uint32_t)cycles);
+		prof->max = MAX(prof->max, (uint32_t)cycles);
+		prof->avg = prof->avg - (prof->avg>>3) + (cycles>>3);
+	}
+	if (prof->runs < UINT16_MAX) {
+		prof->runs++;
+	}
+	if (wrapped && start->active && end.active &&
+			prof->overruns < UINT16_MAX) {
+		prof->overruns++;
+	}
+}
+
+void loop_prof_foreach(loop_prof_cb cb, void *ctx)
 {
 	struct loop_func *f;
+	struct loop_timer *t;
+	int i;
+
+	for (i = LOOP_PRIO_MAX - 1; i >= 0; i--) {
+		for (f = d->f_head[i]; f; f = f->next) {
+			cb((uint32_t)f->func_cb, FALSE, &f->prof, ctx);
+		}
+	}
+	for (i = 0; i < LOOP_WHEEL_SLOTS; i++) {
+		for (t = d->wheel[i]; t; t = t->next) {
+			cb((uint32_t)t->timer_cb, TRUE, &t->prof, ctx);
+		}
+	}
+}
+
+void loop_prof_reset(void)
+{
+	struct loop_func *f;
+	struct loop_timer *t;
+	int i;
 
-	while (d->idx < d->func_max && (f = d->f[d->idx])) {
-		if (f->to_delete) {
-			f->to_delete = 0;
-			delete_func(d->idx);
+	for (i = 0; i < LOOP_PRIO_MAX; i++) {
+		for (f = d->f_head[i]; f; f = f->next) {
+			memset(&f->prof, 0, sizeof(struct loop_prof));
+		}
+	}
+	for (i = 0; i < LOOP_WHEEL_SLOTS; i++) {
+		for (t = d->wheel[i]; t; t = t->next) {
+			memset(&t->prof, 0, sizeof(struct loop_prof));
+		}
+	}
+	d->dropped = 0;
+}
+#endif
+
+static void ready_add(struct loop_task *t)
+{
+	t->next = NULL;
+	if (d->ready_tail) {
+		d->ready_tail->next = t;
+	} else {
+		d->ready_head = t;
+	}
+	d->ready_tail = t;
+}
+
+static void task_block(struct loop_task *t, int blocked)
+{
+	if (t->f) {
+		t->f->blocked = blocked;
+	} else {
+		t->t->blocked = blocked;
+	}
+}
+
+// Save task context and go back to the loop
+static void task_switch_out(struct loop_task *t)
+{
+	if (!setjmp(t->ctx)) {
+		longjmp(d->sched, 1);
+	}
+}
+
+// Runs on the task stack, and never returns
+static void __attribute__((noreturn)) task_main(void)
+{
+	struct loop_task *t;
+
+	while (TRUE) {
+		t = d->task;
+		if (t->f) {
+			t->f->func_cb(t->f);
 		} else {
-			d->idx++;
-			if (!f->disabled && !f->blocked) {
-				f->func_cb(f);
-				d->env->f = NULL;
-			}
+			t->t->timer_cb(t->t);
 		}
+		t->f = NULL;
+		t->t = NULL;
+		t->next = d->task_free;
+		d->task_free = t;
+		// Wait here until the task is used again
+		task_switch_out(t);
 	}
 }
 
-static void delete_timer(int i)
+// Run or resume task until it finishes the callback or waits
+static void task_enter(struct loop_task *t)
 {
-	while (d->t[i + 1]) {
-		d->t[i] = d->t[i + 1];
-		i++;
+	d->task = t;
+	if (!setjmp(d->sched)) {
+		if (t->started) {
+			longjmp(t->ctx, 1);
+		}
+		// First run, switch to the task stack
+		t->started = TRUE;
+		__asm__ volatile ("move.l %0, %%sp\n\t"
+				"jmp (%1)" : : "r"(t->stack_top),
+				"a"(task_main) : "memory");
 	}
-	d->t[i] = NULL;
+	d->task = NULL;
 }
 
-static void update_timer(struct loop_timer *t)
+// Returns FALSE if there are no free tasks to run the callback
+static int task_run(struct loop_func *f, struct loop_timer *tm)
 {
-	if (t->frames && !t->blocked) {
-		t->count++;
-		if (t->count >= t->frames) {
-			if (t->auto_reload) {
-				t->count = 0;
-			} else {
-				t->frames = 0;
-			}
-			t->timer_cb(t);
-			d->env->t = NULL;
+	struct loop_task *t = d->task_free;
+
+	if (!t) {
+		return FALSE;
+	}
+	d->task_free = t->next;
+	t->f = f;
+	t->t = tm;
+	task_enter(t);
+
+	return TRUE;
+}
+
+static void tasks_resume(void)
+{
+	struct loop_task *t = d->ready_head;
+	struct loop_task *next;
+
+	// Tasks made ready while resuming these are resumed on next iteration
+	d->ready_head = d->ready_tail = NULL;
+	while (t) {
+		next = t->next;
+		task_enter(t);
+		t = next;
+	}
+}
+
+static void run_func(struct loop_func *f)
+{
+#ifdef LOOP_PROFILE
+	struct prof_stamp start;
+#endif
+
+	if (f->rom && d->rom_locked) {
+		return;
+	}
+	if (!f->disabled && !f->blocked && (!f->work_cb || f->work_cb(f))) {
+		d->busy = TRUE;
+		d->f_run = f;
+		d->t_run = NULL;
+#ifdef LOOP_PROFILE
+		prof_stamp(&start);
+#endif
+		if (!f->task) {
+			f->func_cb(f);
+		} else if (!task_run(f, NULL)) {
+			// No free tasks, try again on next run
+			return;
 		}
+#ifdef LOOP_PROFILE
+		prof_update(&f->prof, &start);
+#endif
+		d->env->f = NULL;
+	}
+}
+
+// Runs the whole high priority list
+static void run_high(void)
+{
+	struct loop_func *f;
+
+	while ((f = d->f_next[LOOP_PRIO_HIGH])) {
+		d->f_next[LOOP_PRIO_HIGH] = f->next;
+		run_func(f);
 	}
+	d->f_next[LOOP_PRIO_HIGH] = d->f_head[LOOP_PRIO_HIGH];
 }
 
+static void run_funcs(void)
+{
+	struct loop_func *f;
+
+	run_high();
+	while ((f = d->f_next[LOOP_PRIO_NORMAL])) {
+		d->f_next[LOOP_PRIO_NORMAL] = f->next;
+		run_func(f);
+		run_high();
+	}
+}
+
+static void update_timer(struct loop_timer *t)
+{
+#ifdef LOOP_PROFILE
+	struct prof_stamp start;
+#endif
+
+	if (t->blocked || (t->task && !d->task_free) ||
+			(t->rom && d->rom_locked)) {
+		// Try again on next frame
+		timer_link(t, d->frame + 1);
+		return;
+	}
+	if (t->auto_reload && t->phase_mode) {
+		// Next frame matching phase, also realigns delayed runs
+		timer_link(t, phase_expiry(t, d->frame + 1));
+	} else if (t->auto_reload) {
+		timer_link(t, d->frame + t->frames);
+	} else {
+		t->frames = 0;
+		timer_unlink(t);
+	}
+	d->t_run = t;
+	d->f_run = NULL;
+#ifdef LOOP_PROFILE
+	prof_stamp(&start);
+#endif
+	if (t->task) {
+		task_run(NULL, t);
+	} else {
+		t->timer_cb(t);
+	}
+#ifdef LOOP_PROFILE
+	prof_update(&t->prof, &start);
+#endif
+	d->env->t = NULL;
+	run_high();
+}
+
+// Only timers on the wheel slot of the current frame are checked
 static void check_timers(void)
 {
 	struct loop_timer *t;
 
-	while (d->idx < d->timer_max && (t = d->t[d->idx])) {
-		if (t->to_delete) {
-			t->to_delete = 0;
-			delete_timer(d->idx);
-		} else {
-			d->idx++;
+	while ((t = d->t_next)) {
+		d->t_next = t->next;
+		// Timers expiring on later wheel laps are skipped
+		if (t->expiry == d->frame) {
 			update_timer(t);
 		}
 	}
 }
 
+// Nothing to do until the VBlank flag changes, wait for it without walking
+// the function lists. Interrupts are not used: vectors live in the flash chip
+static void idle_wait(void)
+{
+	if (d->ready_head || d->post || d->exit) {
+		return;
+	}
+	while ((VDP_CTRL_PORT_W & VDP_STAT_VBLANK) == d->vblank);
+}
+
 int loop(void)
 {
 	struct pend_env env = {};
+	int post;
 	d->env = &env;
 
 	while (!d->exit) {
-		if (LOOP_CHECK_TIMERS == d->check || frame_update()) {
+		if (d->post) {
+			post = d->post;
+			d->post = 0;
+			longjmp(*d->jmp, post);
+		}
+		tasks_resume();
+		if (LOOP_CHECK_TIMERS != d->check && frame_update()) {
 			d->check = LOOP_CHECK_TIMERS;
+			d->t_next = d->wheel[d->frame & LOOP_WHEEL_MASK];
+		}
+		if (LOOP_CHECK_TIMERS == d->check) {
 			check_timers();
-			d->idx = 0;
 			d->check = LOOP_CHECK_FUNCS;
 		} else {
+			d->busy = FALSE;
 			run_funcs();
-			d->idx = 0;
+			if (!d->busy) {
+				idle_wait();
+			}
 		}
+		d->f_next[LOOP_PRIO_NORMAL] = d->f_head[LOOP_PRIO_NORMAL];
+		d->f_next[LOOP_PRIO_HIGH] = d->f_head[LOOP_PRIO_HIGH];
 	}
 
 	return d->exit;
 }
 
+uint16_t loop_frame_get(void)
+{
+	return d->frame;
+}
+
+uint16_t loop_dropped_frames(void)
+{
+	return d->dropped;
+}
+
+void loop_rom_lock(int lock)
+{
+	if (d) {
+		d->rom_locked = lock;
+	}
+}
+
 void loop_deinit(void)
 {
 	if (!d) return;
@@ -233,14 +742,18 @@ void loop_deinit(void)
 	d = NULL;
 }
 
-static int jmp_set(void)
+static int jmp_set(struct loop_wait *w)
 {
 	jmp_buf jmp;
 	int returned;
 	struct pend_env *prev_env = d->env;
 	jmp_buf *prev_jmp = d->jmp;
+	struct loop_wait *prev_wait = d->jmp_wait;
+	void *prev_w_jmp = w->jmp;
 
 	d->jmp = &jmp;
+	d->jmp_wait = w;
+	w->jmp = &jmp;
 
 	returned = setjmp(jmp);
 	if (!returned) {
@@ -248,41 +761,106 @@ static int jmp_set(void)
 	}
 	d->env = prev_env;
 	d->jmp = prev_jmp;
+	d->jmp_wait = prev_wait;
+	w->jmp = prev_w_jmp;
+	// Wake deferred while this wait was running, deliver it now
+	if (prev_wait && prev_wait->post && prev_wait->jmp == prev_jmp) {
+		d->post = prev_wait->post;
+		prev_wait->post = 0;
+	}
 
 	return returned;
 }
 
-int loop_pend(void)
+static int pend_nested(struct loop_wait *w)
 {
 	int returned = 0;
 
+	// High priority functions can also run during the timer check phase,
+	// so use the callback that was started last
 	if (!d->env->f && !d->env->t) {
-		if (LOOP_CHECK_FUNCS == d->check) {
-			d->env->f = d->f[d->idx - 1];
-		} else {
-			d->env->t = d->t[d->idx - 1];
-		}
+		d->env->f = d->f_run;
+		d->env->t = d->t_run;
 	}
 	if (d->env->f) {
 		d->env->f->blocked = 1;
-		returned = jmp_set();
+		returned = jmp_set(w);
 		d->env->f->blocked = 0;
 	} else if (d->env->t) {
 		d->env->t->blocked = 1;
-		returned = jmp_set();
+		returned = jmp_set(w);
 		d->env->t->blocked = 0;
 	}
 
 	return returned;
 }
 
-void loop_post(int return_value)
+int loop_wait(struct loop_wait *w)
+{
+	struct loop_task *t = d->task;
+
+	if (!t) {
+		return pend_nested(w);
+	}
+
+	t->next = NULL;
+	if (w->tail) {
+		w->tail->next = t;
+	} else {
+		w->head = t;
+	}
+	w->tail = t;
+	task_block(t, TRUE);
+	task_switch_out(t);
+	task_block(t, FALSE);
+
+	return t->value;
+}
+
+void loop_wake(struct loop_wait *w, int value)
+{
+	struct loop_task *t = w->head;
+
+	if (t) {
+		w->head = t->next;
+		if (!w->head) {
+			w->tail = NULL;
+		}
+		t->value = value;
+		ready_add(t);
+	} else if (w->jmp && w->jmp != d->jmp) {
+		// A later nested wait must return first, longjmp would unwind it
+		w->post = value;
+	} else if (w->jmp) {
+		if (d->task) {
+			// Cannot leave the task stack now
+			d->post = value;
+		} else {
+			longjmp(*d->jmp, value);
+		}
+	}
+}
+
+void loop_yield(void)
 {
-	if (d->env) {
-		longjmp(*d->jmp, return_value);
+	struct loop_task *t = d->task;
+
+	if (t) {
+		ready_add(t);
+		task_switch_out(t);
 	}
 }
 
+int loop_pend(void)
+{
+	return loop_wait(&d->pend);
+}
+
+void loop_post(int return_value)
+{
+	loop_wake(&d->pend, return_value);
+}
+
 void loop_end(int return_value)
 {
 	d->exit = return_value;
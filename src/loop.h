@@ -13,13 +13,38 @@
  * interface to perform pseudo syncrhonous calls (through the loop_pend() and
  * loop_post() semantics) without disturbing the loop execution.
  *
- * \note Timers will take more frames than expected if loop load is high
- * enough to take more than a frame to complete.
- * \warning Due to the crappy/hacky implementation of the syncrhonous API, when
- * nesting loop_pend() calls, loop_post() will restore control flow reversing
- * the order of the loop_pend() calls. This is probably not what you want, and
- * it is thus discouraged to nest loop_pend() calls unless you know what you
- * are doing.
+ * \note If loop load is high enough to take more than a frame to complete,
+ * timers catch up on the missed frames as soon as possible.
+ *
+ * Functions can set a work callback, so they only run when they have work
+ * to do (e.g. data pending to be sent or received). When no function has
+ * work and no timer is due, the loop just polls the VDP status until the
+ * VBlank flag changes. Functions without a work callback always run, and
+ * thus keep the loop busy, so use them only for actual background work.
+ *
+ * Timers can set a frame phase, so periodic work is spread across frames
+ * instead of firing on the same frames. With LOOP_PHASE_AUTO, the loop
+ * chooses the phase with the lowest timer load when the timer is started.
+ *
+ * Defining LOOP_PROFILE enables per callback cycle profiling, using the VDP
+ * HV counter to timestamp callbacks.
+ *
+ * Functions and timers with the task flag set run their callbacks inside a
+ * task (a coroutine with its own stack, see loop_task_pool_init()). Tasks can
+ * wait on loop_wait(), loop_pend() and loop_yield() without nesting the loop,
+ * so several of them can be waiting at the same time.
+ * \warning When not running inside a task, loop_pend() re-enters the loop on
+ * the same stack. Due to the crappy/hacky implementation of this synchronous
+ * API, when nesting loop_pend() calls, loop_post() will restore control flow
+ * reversing the order of the loop_pend() calls. This is probably not what you
+ * want, and it is thus discouraged to nest loop_pend() calls outside tasks
+ * unless you know what you are doing.
+ *
+ * Functions and timers with the rom flag set have their callbacks executing
+ * from ROM. They are not run while the ROM is locked by loop_rom_lock()
+ * (e.g. while the flash chip is erasing or programming).
+ * \warning Callbacks executing from ROM must not be waiting when the ROM
+ * gets locked, since resuming them would return to ROM code.
  ****************************************************************************/
 
 #include <stdint.h>
@@ -33,21 +58,81 @@
 /// Converts milliseconds to frames, rounding to the nearest.
 #define MS_TO_FRAMES(ms)	(((ms)*FPS/500 + 1)/2)
 
+/// Number of slots of the timer wheel (must be a power of 2)
+#define LOOP_WHEEL_SLOTS	16
+
+/// Frames looked ahead when choosing the phase of LOOP_PHASE_AUTO timers
+#define LOOP_PHASE_HORIZON	64
+
+/// Timer phase modes
+enum loop_phase {
+	LOOP_PHASE_NONE = 0,	///< Timer fires frames after being started
+	LOOP_PHASE_FIXED,	///< Fires on frames matching the phase field
+	LOOP_PHASE_AUTO		///< Phase chosen by the loop on timer start
+};
+
+/// Loop function priority classes
+enum loop_prio {
+	LOOP_PRIO_NORMAL = 0,	///< Functions run in round-robin
+	LOOP_PRIO_HIGH,		///< Run between every lower priority callback
+	LOOP_PRIO_MAX		///< Number of priority classes
+};
+
+#ifdef LOOP_PROFILE
+/// Callback profiling data, cycles are 68000 cycles, measured modulo one
+/// frame
+struct loop_prof {
+	uint32_t min;		///< Minimum cycles taken by a run
+	uint32_t max;		///< Maximum cycles taken by a run
+	uint32_t avg;		///< Average (exponentially weighted) cycles
+	uint16_t runs;		///< Number of runs (saturates)
+	uint16_t overruns;	///< Runs hiding a VBlank from the loop (saturates)
+};
+#endif
+
+struct loop_task;
+
+/// Wait object, tasks wait on it until loop_wake() is called. Zero initialize
+/// it before using it, and do not manually modify its fields.
+struct loop_wait {
+	struct loop_task *head;	///< First waiting task
+	struct loop_task *tail;	///< Last waiting task
+	void *jmp;		///< Innermost nested (not in task) wait
+	int post;		///< Wake deferred until the nested wait is innermost
+};
+
 struct loop_func;
 
 /// Loop function callback definition
 typedef void (*loop_func_cb)(struct loop_func *f);
 
+/// Loop function work check callback definition, returns TRUE when the
+/// function has work to do
+typedef int (*loop_work_cb)(struct loop_func *f);
+
 /// Loop function data structure
 struct loop_func {
 	/// Function callback to run on the loop
 	loop_func_cb func_cb;	///< Function callback to run on the loop
+	/// Optional, function only runs when it returns TRUE
+	loop_work_cb work_cb;
+	struct loop_func *next;	///< Next function (do not manually modify)
+	struct loop_func *prev;	///< Previous function (do not manually modify)
 	struct {
+		/// Priority class (enum loop_prio), set before adding the function
+		uint16_t prio:1;
+		/// Run callback inside a task, set before adding the function
+		uint16_t task:1;
+		/// Callback executes from ROM, see loop_rom_lock()
+		uint16_t rom:1;
 		// Do not manually modify these fields
-		uint16_t to_delete:1; ///< Delete function when 1
+		uint16_t linked:1;    ///< Function is in the loop list
 		uint16_t blocked:1;   ///< Blocked on a loop_pend()
 		uint16_t disabled:1;  ///< Function disabled when 1
 	};
+#ifdef LOOP_PROFILE
+	struct loop_prof prof;	///< Profiling data (do not manually modify)
+#endif
 };
 
 struct loop_timer;
@@ -59,13 +144,29 @@ typedef void (*loop_timer_cb)(struct loop_timer *t);
 struct loop_timer {
 	loop_timer_cb timer_cb;	///< Timer callback function
 	uint16_t frames;	///< Timer duration in frames
-	uint16_t count;		///< Timer counter (do not manually modify)
+	uint16_t expiry;	///< Expiration frame (do not manually modify)
+	/// Frame number modulo frames on which the timer fires, for
+	/// LOOP_PHASE_FIXED timers (must be lower than frames). Set by the
+	/// loop for LOOP_PHASE_AUTO timers.
+	uint16_t phase;
+	/// Next timer in the wheel slot (do not manually modify)
+	struct loop_timer *next;
+	/// Previous timer in the wheel slot (do not manually modify)
+	struct loop_timer *prev;
 	struct {
 		uint16_t auto_reload:1;	///< Set for timer auto-reload
-	/// Delete timer when 1 (do not manually modify)
-		uint16_t to_delete:1;
+		uint16_t task:1;	///< Run callback inside a task
+		uint16_t phase_mode:2;	///< Phase mode (enum loop_phase)
+		uint16_t rom:1;		///< Callback executes from ROM
+		/// Timer has been added to the loop (do not manually modify)
+		uint16_t added:1;
+		/// Timer is in a wheel slot (do not manually modify)
+		uint16_t linked:1;
 		uint16_t blocked:1;   ///< Blocked on a loop_pend()
 	};
+#ifdef LOOP_PROFILE
+	struct loop_prof prof;	///< Profiling data (do not manually modify)
+#endif
 };
 
 /************************************************************************//**
@@ -78,6 +179,20 @@ struct loop_timer {
  ****************************************************************************/
 int loop_init(uint8_t max_func, uint8_t max_timer);
 
+/************************************************************************//**
+ * \brief Allocate the task pool, used to run callbacks with the task flag.
+ *
+ * \param[in] tasks     Number of tasks. This limits the number of task
+ *                      callbacks that can be waiting at the same time.
+ * \param[in] stack_len Length of the stack of each task, in bytes.
+ *
+ * \return 0 on success, 1 if there is not enough memory in the pool.
+ *
+ * \note Task stacks are allocated with mp_alloc(), call this function once
+ * after loop_init().
+ ****************************************************************************/
+int loop_task_pool_init(uint8_t tasks, uint16_t stack_len);
+
 /************************************************************************//**
  * \brief Add a function to the loop.
  *
@@ -85,7 +200,9 @@ int loop_init(uint8_t max_func, uint8_t max_timer);
  *
  * \return 0 on success, 1 if maximun number of functions has been reached.
  *
- * \note Function will enabled and added to the end of the function list.
+ * \note Function will enabled and added to the end of the function list of
+ * its priority class. LOOP_PRIO_HIGH functions are run after every timer and
+ * every LOOP_PRIO_NORMAL function callback, so keep them short.
  ****************************************************************************/
 int loop_func_add(struct loop_func *func);
 
@@ -127,16 +244,31 @@ static inline void loop_func_enable(struct loop_func *func)
  ****************************************************************************/
 int loop_timer_add(struct loop_timer *timer);
 
+/************************************************************************//**
+ * \brief Schedule a timer according to its frames field. Timers with frames
+ * set to 0 are removed from the timer wheel.
+ *
+ * \param[in] timer Pointer to the timer to schedule.
+ *
+ * \note Use loop_timer_start() and loop_timer_stop() instead.
+ ****************************************************************************/
+void loop_timer_sched(struct loop_timer *timer);
+
 /************************************************************************//**
  * \brief Start a previously added timer.
  *
  * \param[in] timer  Pointer to the previously added timer to start.
  * \param[in] frames Number of frames after the timer will trigger.
+ *
+ * \note Timers with a phase mode trigger on the first frame matching their
+ * phase, after the specified number of frames have elapsed. Phases are
+ * computed on the wrapping 16-bit frame counter, so when frames is not a
+ * power of 2, a period is shortened when the counter wraps.
  ****************************************************************************/
 static inline void loop_timer_start(struct loop_timer *timer, int frames)
 {
 	timer->frames = frames;
-	timer->count = 0;
+	loop_timer_sched(timer);
 }
 
 /************************************************************************//**
@@ -147,6 +279,7 @@ static inline void loop_timer_start(struct loop_timer *timer, int frames)
 static inline void loop_timer_stop(struct loop_timer *timer)
 {
 	timer->frames = 0;
+	loop_timer_sched(timer);
 }
 
 /************************************************************************//**
@@ -155,9 +288,6 @@ static inline void loop_timer_stop(struct loop_timer *timer)
  * \param[in] timer Pointer to the timer data structure to delete.
  *
  * \return 0 on success, 1 if requested timer to delete was not found.
- * \warning Loop deletion is delayed a bit (in the worst case, until the next
- * frame is processed by the loop). Thus do not deallocate the timer structure
- * immediately when this function returns.
  ****************************************************************************/
 int loop_timer_del(struct loop_timer *timer);
 
@@ -171,6 +301,56 @@ int loop_timer_del(struct loop_timer *timer);
  ****************************************************************************/
 int loop(void);
 
+/************************************************************************//**
+ * \brief Get the number of the last frame processed by the loop.
+ *
+ * \return Frame number (wraps around).
+ ****************************************************************************/
+uint16_t loop_frame_get(void);
+
+/************************************************************************//**
+ * \brief Get the number of frames missed by the loop.
+ *
+ * Frames are counted by polling the VDP VBlank flag, interrupts are not
+ * used. When a callback runs for long enough to hide a whole VBlank period,
+ * the frame is detected later from the V counter, timers catch up on it,
+ * and it is reported as dropped. Several frames missed in a row count as
+ * one.
+ *
+ * \return Number of dropped frames since loop_init() (wraps around).
+ ****************************************************************************/
+uint16_t loop_dropped_frames(void);
+
+#ifdef LOOP_PROFILE
+/************************************************************************//**
+ * \brief Profiling data callback, see loop_prof_foreach().
+ *
+ * \param[in] cb    Address of the profiled callback function.
+ * \param[in] timer TRUE if the callback belongs to a timer, FALSE if it
+ *                  belongs to a loop function.
+ * \param[in] prof  Profiling data of the callback.
+ * \param[in] ctx   Context passed to loop_prof_foreach().
+ ****************************************************************************/
+typedef void (*loop_prof_cb)(uint32_t cb, int timer,
+		const struct loop_prof *prof, void *ctx);
+
+/************************************************************************//**
+ * \brief Run a callback for each profiled loop function and timer.
+ *
+ * \param[in] cb  Callback to run with the profiling data.
+ * \param[in] ctx Context passed to the callback.
+ *
+ * \note Only added functions and running timers are reported.
+ ****************************************************************************/
+void loop_prof_foreach(loop_prof_cb cb, void *ctx);
+
+/************************************************************************//**
+ * \brief Clear profiling data of all added functions and running timers,
+ * and the dropped frames counter.
+ ****************************************************************************/
+void loop_prof_reset(void);
+#endif
+
 /************************************************************************//**
  * \brief De-initialize loop module, and free associated resources.
  *
@@ -181,23 +361,68 @@ int loop(void);
  ****************************************************************************/
 void loop_deinit(void);
 
+/************************************************************************//**
+ * \brief Lock or unlock the ROM. While locked, functions and timers with the
+ * rom flag set are not run, and are delayed until the ROM is unlocked.
+ *
+ * \param[in] lock TRUE to lock the ROM, FALSE to unlock it.
+ ****************************************************************************/
+void loop_rom_lock(int lock);
+
+/************************************************************************//**
+ * \brief Wait until loop_wake() is called on the wait object.
+ *
+ * While waiting, the loop continues to run, and other functions and timers
+ * are normally run. The function or timer that called this function is not
+ * run until it returns. When called inside a task, the task is suspended and
+ * resumed by the loop. Otherwise the loop is re-entered on the same stack.
+ *
+ * \param[in] w Wait object.
+ *
+ * \return Value passed to loop_wake().
+ ****************************************************************************/
+int loop_wait(struct loop_wait *w);
+
+/************************************************************************//**
+ * \brief Wake the task that has been waiting for longer on a wait object.
+ *
+ * The task is resumed by the loop after the running callback returns. If no
+ * task is waiting, the innermost nested wait on the object returns
+ * immediately. If another nested wait (on a different object) started later
+ * is still pending, the wake is deferred until that wait returns.
+ *
+ * \param[in] w     Wait object.
+ * \param[in] value Value to be returned by loop_wait(). Must be non-zero when
+ *                  waking a nested (not in task) wait.
+ ****************************************************************************/
+void loop_wake(struct loop_wait *w, int value);
+
+/************************************************************************//**
+ * \brief Let the loop run other callbacks, and resume afterwards.
+ *
+ * \note Does nothing when not called from inside a task.
+ ****************************************************************************/
+void loop_yield(void);
+
 /************************************************************************//**
  * \brief This function does not return until a loop_post() is executed.
  *
- * While in this function, the loop continues to run, and other functions and
- * timers are normally run. Use with care, specially if you are low on stack.
+ * Same as loop_wait(), using a wait object internal to the loop module.
+ * Use with care, specially if you are low on stack and not in a task.
  *
  * \return A non-zero value, passed to the loop_post() function causing this
  * function to return, or zero on error.
  *
- * \warning Do not call this function if there is already a previous call to
- * loop_pend() that has not yet returned.
+ * \warning Outside tasks, do not call this function if there is already a
+ * previous call to loop_pend() that has not yet returned.
  ****************************************************************************/
 int loop_pend(void);
 
 /************************************************************************//**
  * \brief Causes a previously invoked loop_pend() function to return.
  *
+ * Same as loop_wake(), using the wait object internal to the loop module.
+ *
  * \param[in] return_value Number to be returned by loop_pend(). Must be
  *            non-zero, or otherwise loop_pend() will not return.
  *
@@ -19,15 +19,27 @@
 #include "snd/sound.h"
 #include "gfx/background.h"
 #include "flash.h"
+#include "ovl.h"
+#include "prof.h"
 
 /// TCP port to use (set to Megadrive release year ;-)
 #define MW_CH_PORT 	1985
 
 /// Maximum number of loop functions
-#define MW_MAX_LOOP_FUNCS	2
+#define MW_MAX_LOOP_FUNCS	4
+
+/// Number of loop tasks: frame timer and sysfsm receive function
+#define MW_LOOP_TASKS		2
+
+/// Stack length for each loop task
+#define MW_LOOP_TASK_STACK_LEN	2048
 
 /// Maximun number of loop timers
+#ifdef LOOP_PROFILE
+#define MW_MAX_LOOP_TIMERS	5
+#else
 #define MW_MAX_LOOP_TIMERS	4
+#endif
 
 static void idle_cb(struct loop_func *f)
 {
@@ -35,6 +47,26 @@ static void idle_cb(struct loop_func *f)
 	mw_process();
 }
 
+// UART is only polled while there are frames being sent or received
+static int idle_work_cb(struct loop_func *f)
+{
+	UNUSED_PARAM(f);
+	return mw_busy();
+}
+
+static void shadow_flush_cb(struct loop_func *f)
+{
+	UNUSED_PARAM(f);
+	VdpShadowFlush();
+}
+
+// Plane shadow is flushed only during VBlank, when DMA is fastest
+static int shadow_work_cb(struct loop_func *f)
+{
+	UNUSED_PARAM(f);
+	return VdpShadowPending() && (VDP_CTRL_PORT_W & VDP_STAT_VBLANK);
+}
+
 /// Run once per frame
 static void frame_cb(struct loop_timer *t)
 {
@@ -43,6 +75,9 @@ static void frame_cb(struct loop_timer *t)
 
 	// Read controller and update menu
 	pad_ev = ~gp_pressed();
+#ifdef LOOP_PROFILE
+	pad_ev = prof_pad_filter(pad_ev);
+#endif
 	menu_update(pad_ev);
 }
 
@@ -73,6 +108,8 @@ static void megawifi_init_cb(struct loop_timer  *t)
 		str_buf[stat.length++] = '.';
 		stat.length += uint8_to_str(ver_minor,
 				str_buf + stat.length);
+		// Use frames as long as the command buffer allows
+		mw_frame_len_set(MW_BUFLEN);
 	}
 	str_buf[20 - 1] = '\0';	// Ensure null termination
 	menu_stat_str_set(&stat);
@@ -84,31 +121,77 @@ static void main_loop_init(void)
 	static struct loop_timer frame_timer = {
 		.timer_cb = megawifi_init_cb,
 		.frames = 1,
-		.auto_reload = TRUE
+		.auto_reload = TRUE,
+		// Menu actions wait for module replies
+		.task = TRUE,
+		// Menu code executes from ROM
+		.rom = TRUE
 	};
+	// UART FIFO servicing is latency critical, run it at high priority
 	static struct loop_func megawifi_loop = {
-		.func_cb = idle_cb
+		.func_cb = idle_cb,
+		.work_cb = idle_work_cb,
+		.prio = LOOP_PRIO_HIGH
+	};
+	// Must catch the VBlank, run it at high priority too
+	static struct loop_func shadow_loop = {
+		.func_cb = shadow_flush_cb,
+		.work_cb = shadow_work_cb,
+		.prio = LOOP_PRIO_HIGH
 	};
 
 	loop_init(MW_MAX_LOOP_FUNCS, MW_MAX_LOOP_TIMERS);
+	loop_task_pool_init(MW_LOOP_TASKS, MW_LOOP_TASK_STACK_LEN);
 	loop_timer_add(&frame_timer);
 	loop_func_add(&megawifi_loop);
+	loop_func_add(&shadow_loop);
+#ifdef LOOP_PROFILE
+	prof_init();
+#endif
 }
 
 static void flash_id_init(void)
 {
 	uint8_t id[4];
+
+	ovl_load(OVL_FLASH);
 	id[0] = FlashGetManId();
 	FlashGetDevId(&id[1]);
 
 	set_flash_id(id);
 }
 
-/// Global initialization
+/// Boot from specified address, defined in sega.s
+void boot_addr(uint32_t addr);
+
+/// Boot the installed program, unless the menu is needed
+static void fast_boot(void)
+{
+	extern uint32_t dirty_dw;
+	uint32_t magic = dirty_dw;
+	uint8_t pad;
+
+	// Request is consumed, next reset boots the program again
+	dirty_dw = 0;
+
+	// Pad is read twice, so TH line settles after port initialization
+	gp_init();
+	gp_read();
+	pad = ~gp_read();
+
+	if (MAGIC_WIFI_CONFIG == magic ||
+			USER_WIFI_CONFIG == (pad & USER_WIFI_CONFIG) ||
+			!GL_ENTRY_POINT_VALID()) {
+		return;
+	}
+
+	// VDP, sound and pads are left untouched for the program
+	boot_addr(GL_ENTRY_POINT_ADDR);
+}
+
+/// Global initialization, only run when the menu is needed
 static void init(void)
 {
-	// Get flash ID early
-	flash_id_init();
 	// Initialize memory pool
 	mp_init(0);
 	// Initialize VDP
@@ -122,7 +205,7 @@ static void init(void)
 	// Initialize menu system
 	menu_init(&main_menu, &(struct menu_str)MENU_STR_RO("Init..."));
 	// Initializes sound, starts the song
-	sound_init(menu_01_00_data, sfx_data);
+	sound_init(menu_01_00_data, menu_01_00_len, sfx_data, sfx_len);
 	// Initialize scrolling background layer
 	bg_init();
 }
@@ -132,6 +215,10 @@ int entry_point(uint16_t hard)
 {
 	UNUSED_PARAM(hard);
 
+	// Get flash ID early
+	flash_id_init();
+	// Boot the program without initializing anything else if possible
+	fast_boot();
 	init();
 
 	// Enter game loop (should never return)
@@ -165,6 +165,13 @@ static struct menu_entry *menu_alloc_cpy(const struct menu_entry *entry)
 void menu_init(const struct menu_entry *root, struct menu_str *status)
 {
 	menu = mp_calloc(sizeof(struct menu_instance));
+	if (!menu || mp_block_pool_init(&menu->instances,
+			sizeof(struct menu_entry_instance), MENU_LEVEL_MAX)) {
+		// Menus cannot work at all, tell it instead of a black screen
+		VdpDrawText(VDP_PLANEA_ADDR, 1, 1, VDP_TXT_COL_WHITE,
+				MENU_LINE_CHARS, "MENU: OUT OF MEMORY", 0);
+		while (1);
+	}
 	menu->right_context.str = menu->context_buf;
 	menu->right_context.max_length = MENU_STATUS_MAX_CHR;
 	menu_str_cpy(&menu->right_context, status);
@@ -216,8 +223,15 @@ void menu_enter(const struct menu_entry *next)
 	struct menu_entry *entry;
 	int err = FALSE;
 
-	// Allocate and fill new menu instance
-	instance = mp_alloc(sizeof(struct menu_entry_instance));
+	// Allocate new menu instance, entry data goes to the instance arena
+	instance = mp_block_alloc(&menu->instances);
+	if (!instance) {
+		// Stay on current menu, but do not drop the entry silently
+		menu_stat_str_set(&(struct menu_str)MENU_STR_RO("TOO DEEP!"));
+		psgfx_play(SFX_MENU_BACK);
+		return;
+	}
+	mp_arena_mark(&instance->arena, "menu");
 
 	// Draw new entry in the centered (not visible) area
 	entry = menu_alloc_cpy(next);
@@ -256,7 +270,8 @@ void menu_enter(const struct menu_entry *next)
 		menu->level++;
 	} else {
 		// Init failed, roll back
-		mp_free_to(instance);
+		mp_arena_release(&instance->arena);
+		mp_block_free(&menu->instances, instance);
 	}
 }
 
@@ -298,8 +313,9 @@ void menu_back(int levels)
 			to_dealloc->entry->exit_cb(to_dealloc);
 		}
 		menu->instance = to_dealloc->prev;
+		mp_arena_release(&to_dealloc->arena);
+		mp_block_free(&menu->instances, to_dealloc);
 	}
-	mp_free_to(to_dealloc);
 	menu_draw_context(MENU_PLACE_CENTER);
 	if (MENU_TYPE_MSG != type) {
 		menu_item_enter();
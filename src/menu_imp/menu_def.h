@@ -4,6 +4,7 @@
 #define _MENU_DEF_H_
 
 #include "menu_str.h"
+#include "../mpool.h"
 
 #define MENU_STATUS_MAX_CHR	12
 
@@ -124,6 +125,8 @@ struct menu_entry {
 struct menu_entry_instance {
 	struct menu_entry *entry;
 	struct menu_entry_instance *prev;
+	/// Arena holding the entry copy and data allocated by its callbacks
+	struct mp_arena arena;
 	uint8_t sel_item;
 	uint8_t sel_page;
 };
@@ -21,12 +21,16 @@ struct menu_osk_coord {
 	uint8_t col:4;	///< Keyboard column
 };
 
+/// Maximum menu depth
+#define MENU_LEVEL_MAX		8
+
 /// Holds the data required for a menu instance
 struct menu_instance {
 	enum menu_stat stat;			///< The menu status
 	uint16_t offset;			///< Offset for animations
 	uint16_t anim_step;			///< Step used for animations
 	struct menu_entry_instance *instance;	///< Current menu instance
+	struct mp_block_pool instances;		///< Menu entry instances pool
 	struct menu_str right_context;		///< Context string, right side
 	char context_buf[MENU_LINE_CHARS];	///< Context string buffer
 	struct menu_osk_coord coord;		///< Coords for OSK menus
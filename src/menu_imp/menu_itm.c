@@ -41,6 +41,15 @@ static void menu_item_single(struct menu_item *item, uint8_t line,
 	struct menu_entry_instance *instance = menu->instance;
 	struct menu_str str;
 
+	// Only masked and empty captions need a modified copy
+	if (!item->secure && !(item->draw_empty &&
+				item->caption.length <= item->offset)) {
+		menu_str_line_draw(&item->caption, line,
+				instance->entry->margin,
+				instance->entry->item_entry->align, color, loc);
+		return;
+	}
+
 	str.str = mp_alloc(item->caption.max_length);
 	str.max_length = item->caption.max_length;
 	str.length = 0;
@@ -59,6 +68,20 @@ static void menu_item_single(struct menu_item *item, uint8_t line,
 	mp_free_to(str.str);
 }
 
+/// Color used to draw an item
+static uint8_t menu_item_color(uint8_t item_num)
+{
+	struct menu_item_entry *entry = menu->instance->entry->item_entry;
+
+	if (menu->instance->sel_item == item_num) {
+		return MENU_COLOR_ITEM_SEL;
+	} else if (entry->item[item_num].alt_color) {
+		return MENU_COLOR_ITEM_ALT;
+	}
+
+	return MENU_COLOR_ITEM;
+}
+
 void menu_item_draw(enum menu_placement loc)
 {
 	struct menu_item_entry *entry = menu->instance->entry->item_entry;
@@ -67,7 +90,6 @@ void menu_item_draw(enum menu_placement loc)
 	uint8_t line = MENU_LINE_ITEM_FIRST;
 	uint8_t num_items;
 	uint8_t top_item;
-	uint8_t color;
 	int i;
 
 	top_item = instance->sel_page * entry->items_per_page;
@@ -79,14 +101,8 @@ void menu_item_draw(enum menu_placement loc)
 		if (item->hidden) {
 			menu_str_line_clear(loc, line);
 		} else {
-			if (instance->sel_item == (top_item + i)) {
-				color = MENU_COLOR_ITEM_SEL;
-			} else if (item->alt_color) {
-				color = MENU_COLOR_ITEM_ALT;
-			} else {
-				color = MENU_COLOR_ITEM;
-			}
-			menu_item_single(item, line, color, loc);
+			menu_item_single(item, line,
+					menu_item_color(top_item + i), loc);
 		}
 	}
 	// Clear empty lines
@@ -100,6 +116,28 @@ void menu_item_draw(enum menu_placement loc)
 	}
 }
 
+void menu_item_redraw(uint8_t item_num)
+{
+	struct menu_item_entry *entry = menu->instance->entry->item_entry;
+	struct menu_item *item = &entry->item[item_num];
+	uint8_t top_item = menu->instance->sel_page * entry->items_per_page;
+	uint8_t line;
+
+	// Items in other pages are drawn when their page is selected
+	if (item_num < top_item ||
+			item_num >= top_item + entry->items_per_page) {
+		return;
+	}
+
+	line = MENU_LINE_ITEM_FIRST + entry->spacing * (item_num - top_item);
+	if (item->hidden) {
+		menu_str_line_clear(MENU_PLACE_CENTER, line);
+	} else {
+		menu_item_single(item, line, menu_item_color(item_num),
+				MENU_PLACE_CENTER);
+	}
+}
+
 /// Return the line number of the current selection
 static uint8_t menu_item_current_line_num(void)
 {
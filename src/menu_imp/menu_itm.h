@@ -31,6 +31,9 @@ int menu_item_update(uint8_t gp_press, struct menu_entry **next);
  * Draws the corresponding item page.
  *
  * Other than the items in the drawn page, nothing is modified on the screen.
+ * Only cells that change are sent to VRAM, but all the page items are
+ * formatted. Use menu_item_redraw() when a single item changes.
+ *
  * \param[in] loc Location in which the menu will be cleared.
  *
  * \note This functions checks for DMA to be inactive on enter.
@@ -38,6 +41,15 @@ int menu_item_update(uint8_t gp_press, struct menu_entry **next);
  ****************************************************************************/
 void menu_item_draw(enum menu_placement loc);
 
+/************************************************************************//**
+ * Redraws a single item of the current menu entry, in the centered location.
+ *
+ * Nothing is drawn if the item is not in the selected page.
+ *
+ * \param[in] item_num Number of the item to redraw.
+ ****************************************************************************/
+void menu_item_redraw(uint8_t item_num);
+
 /************************************************************************//**
  * Clears the text of a menu in the specified location
  *
@@ -50,27 +50,16 @@ static void frame_draw(uint16_t addr, uint8_t hor_length,
 {
 	int i;
 
-	VdpDmaWait();
-	VdpDmaVRamFill(addr + 2, hor_length, 2, 0);
-	VdpDmaWait();
-	VdpDmaVRamFill(addr, hor_length - 1, 2, 0x5F00);
-	VdpDmaWait();
-	VdpRamWrite(VDP_VRAM_WR, addr, 0x5F);
+	VdpCellsFill(addr, 0x5F, hor_length);
 	addr += 2 * VDP_PLANE_HTILES;
 
 	for (i = 0; i < ver_length; i++, addr += 2 * VDP_PLANE_HTILES) {
-		VdpRamWrite(VDP_VRAM_WR, addr, 0x5F);
-		VdpDmaVRamFill(addr + 2, 2 * (hor_length - 2), 1, 0x00);
-		VdpDmaWait();
-		VdpRamWrite(VDP_VRAM_WR, addr + 2 * (hor_length - 1), 0x5F);
+		VdpCellsFill(addr, 0x5F, 1);
+		VdpCellsFill(addr + 2, 0, hor_length - 2);
+		VdpCellsFill(addr + 2 * (hor_length - 1), 0x5F, 1);
 	}
-		
-	VdpDmaWait();
-	VdpDmaVRamFill(addr + 2, hor_length, 2, 0);
-	VdpDmaWait();
-	VdpDmaVRamFill(addr, hor_length - 1, 2, 0x5F00);
-	VdpDmaWait();
-	VdpRamWrite(VDP_VRAM_WR, addr, 0x5F);
+
+	VdpCellsFill(addr, 0x5F, hor_length);
 }
 
 //static void buttons_draw(uint8_t selected, const struct menu_msg_entry *entry)
@@ -83,8 +72,7 @@ static void rect_copy(uint16_t org_addr, uint16_t dst_addr,
 		int16_t hor_length, uint16_t ver_length)
 {
 	for (uint16_t i = 0; i < (ver_length + 2); i++) {
-		VdpDmaWait();
-		VdpDmaVRamCopy(org_addr, dst_addr, hor_length * 2);
+		VdpCellsCopy(org_addr, dst_addr, hor_length);
 		org_addr += VDP_PLANE_HTILES * 2;
 		dst_addr += VDP_PLANE_HTILES * 2;
 	}
@@ -236,22 +236,17 @@ static void menu_osk_draw_std_keys(enum menu_placement loc)
 	uint8_t i = menu->instance->entry->osk_entry->osk_type;
 	uint8_t rows = osk[i].rows;
 	uint8_t cols = osk[i].cols;
-	uint8_t key_idx;
 	uint8_t row, col;
+	uint8_t color;
 
-	for (row = 0, key_idx = 0; row < rows; row++) {
-		for (col = 0; col < cols; col++, key_idx++) {
-			menu_osk_draw_std_key(i, row, col,
-					MENU_COLOR_ITEM, loc);
+	for (row = 0; row < rows; row++) {
+		for (col = 0; col < cols; col++) {
+			color = row == menu->coord.row &&
+				col == menu->coord.col ?
+				MENU_COLOR_ITEM_SEL : MENU_COLOR_ITEM;
+			menu_osk_draw_std_key(i, row, col, color, loc);
 		}
 	}
-
-	// Redraw selected key if applicable
-	row = menu->coord.row;
-	col = menu->coord.col;
-	if (row < rows && col < cols) {
-		menu_osk_draw_std_key(i, row, col, MENU_COLOR_ITEM_SEL, loc);
-	}
 }
 
 static void menu_osk_draw_keys(enum menu_placement loc)
@@ -264,8 +259,8 @@ static void menu_osk_draw_keys(enum menu_placement loc)
 	menu_osk_draw_special_keys(loc);
 	
 	if (osk[i].flags.space) {
-		menu_osk_draw_space(loc, menu->coord.row >= osk[i].rows?
-				MENU_COLOR_ITEM_SEL:MENU_COLOR_ITEM);
+		menu_osk_draw_space(menu->coord.row >= osk[i].rows?
+				MENU_COLOR_ITEM_SEL:MENU_COLOR_ITEM, loc);
 	}
 }
 
@@ -276,6 +271,17 @@ static void menu_osk_draw_cursor(enum menu_placement loc)
 			MENU_COLOR_ITEM_SEL, 1, &(char){MENU_OSK_KEY_CURSOR});
 }
 
+/// Draws the input data character under the cursor, removing the cursor
+static void menu_osk_draw_data_chr(enum menu_placement loc)
+{
+	struct menu_str *tmp = &menu->instance->entry->osk_entry->tmp;
+	char chr = menu->cursor < tmp->length ? tmp->str[menu->cursor] : ' ';
+
+	VdpDrawChars(VDP_PLANEA_ADDR, loc + menu->instance->entry->margin +
+			menu->cursor, MENU_LINE_OSK_DATA,
+			MENU_COLOR_OSK_DATA, 1, &chr);
+}
+
 static void menu_osk_draw(enum menu_placement loc)
 {
 	struct menu_osk_entry *entry = menu->instance->entry->osk_entry;
@@ -462,15 +468,14 @@ static void menu_osk_move_chr(int value)
 {
 	struct menu_str *tmp = &menu->instance->entry->osk_entry->tmp;
 
+	// Moving the cursor only changes the old and new cursor cells
+	menu_osk_draw_data_chr(MENU_PLACE_CENTER);
 	menu->cursor += value;
 	if (menu->cursor < 0) {
 		menu->cursor = 0;
 	} else if (menu->cursor > tmp->length) {
 		menu->cursor = tmp->length;
 	}
-	menu_str_line_draw(tmp, MENU_LINE_OSK_DATA,
-			MENU_DEF_LEFT_MARGIN, MENU_H_ALIGN_LEFT,
-			MENU_COLOR_OSK_DATA, MENU_PLACE_CENTER);
 	menu_osk_draw_cursor(MENU_PLACE_CENTER);
 	psgfx_play(SFX_MENU_ENTER);
 }
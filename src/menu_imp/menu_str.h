@@ -206,13 +206,13 @@ static inline void menu_str_replace(struct menu_str *dst, const char *replace)
  * \param[in] loc  Location of the screen to clear.
  * \param[in] line Line number to clear.
  *
- * \note Checks for DMA not to be active before writing to VDP.
- * \warning Leaves DMA active when returns.
+ * \note Lines are written to the plane shadow, and reach VRAM on the next
+ * VdpShadowFlush().
  ****************************************************************************/
 static inline void menu_str_line_clear(enum menu_placement loc, int line)
 {
-	VdpDmaWait();
-	VdpLineClear(VDP_PLANEA_ADDR + loc, line);
+	VdpCellsFill(VDP_PLANEA_ADDR + 2 * (loc + VDP_PLANE_HTILES * line), 0,
+			MENU_LINE_CHARS);
 }
 
 /************************************************************************//**
@@ -222,16 +222,15 @@ static inline void menu_str_line_clear(enum menu_placement loc, int line)
  * \param[in] src  Location of the screen to which line is copied.
  * \param[in] line Line number to copy.
  *
- * \note Checks for DMA not to be active before writing to VDP.
- * \warning Leaves DMA active when returns.
+ * \note Lines are written to the plane shadow, and reach VRAM on the next
+ * VdpShadowFlush().
  ****************************************************************************/
 static inline void menu_str_line_copy(enum menu_placement dst, enum menu_placement src,
 		uint8_t line)
 {
-	VdpDmaWait();
-	VdpDmaVRamCopy(VDP_PLANEA_ADDR + 2 * (src + VDP_PLANE_HTILES * line),
+	VdpCellsCopy(VDP_PLANEA_ADDR + 2 * (src + VDP_PLANE_HTILES * line),
 			VDP_PLANEA_ADDR + 2 * (dst + VDP_PLANE_HTILES * line),
-			2 * MENU_LINE_CHARS);
+			MENU_LINE_CHARS);
 }
 
 #endif /*_MENU_STR_H_*/
@@ -1,13 +1,136 @@
+#include <string.h>
 #include "menu_dl.h"
 #include "menu_txt.h"
 #include "comm_buf.h"
 #include "../globals.h"
 #include "../sysfsm.h"
+#include "../loop.h"
 #include "../mw/megawifi.h"
 #include "../menu_imp/menu.h"
 #include "../menu_imp/menu_itm.h"
 #include "../gfx/background.h"
-#include "../snd/sound.h"
+
+/// Frames to wait for a targeted association before falling back to scan
+#define DL_FAST_ASSOC_TOUT	MS_TO_FRAMES(5000)
+
+/// Frames to wait for association after a full scan
+#define DL_ASSOC_TOUT		MS_TO_FRAMES(39000)
+
+/// Marks a valid AP association cache
+#define DL_AP_CACHE_MAGIC	0x41504341
+
+/// Association data of the last AP joined using a configuration slot
+struct dl_ap_cache_slot {
+	uint8_t bssid[MW_BSSID_LEN];	///< AP BSSID
+	uint8_t channel;		///< AP channel, 0 if unknown
+	uint8_t valid;			///< Non-zero if entry is valid
+};
+
+/// AP association cache, stored in the WiFi module flash
+struct dl_ap_cache {
+	uint32_t magic;			///< DL_AP_CACHE_MAGIC if valid
+	struct dl_ap_cache_slot slot[MW_NUM_CFG_SLOTS];
+};
+
+static int ap_cache_load(struct dl_ap_cache *cache)
+{
+	uint8_t *data;
+
+	data = mw_flash_read(GL_MW_FLASH_AP_CACHE_ADDR,
+			sizeof(struct dl_ap_cache));
+	if (!data) {
+		return 1;
+	}
+	memcpy(cache, data, sizeof(struct dl_ap_cache));
+	if (DL_AP_CACHE_MAGIC != cache->magic) {
+		memset(cache, 0, sizeof(struct dl_ap_cache));
+		cache->magic = DL_AP_CACHE_MAGIC;
+	}
+
+	return 0;
+}
+
+static void ap_cache_save(const struct dl_ap_cache *cache)
+{
+	if (!mw_flash_sector_erase(GL_MW_FLASH_AP_CACHE_ADDR /
+				SF_STAGE_SECT_LEN)) {
+		mw_flash_write(GL_MW_FLASH_AP_CACHE_ADDR, (uint8_t*)cache,
+				sizeof(struct dl_ap_cache));
+	}
+}
+
+// Stores the BSSID of the associated AP, only if it changed
+static void ap_cache_update(struct dl_ap_cache *cache, uint8_t slot)
+{
+	struct dl_ap_cache_slot *entry = &cache->slot[slot];
+	uint8_t *bssid;
+
+	bssid = mw_bssid_get(MW_IF_STATION);
+	if (!bssid || (entry->valid &&
+			!memcmp(entry->bssid, bssid, MW_BSSID_LEN))) {
+		return;
+	}
+
+	// The module does not report the channel. The one from the scan used
+	// to configure the slot is kept for its first AP, but another AP with
+	// the same SSID might be on a different channel.
+	if (entry->valid) {
+		entry->channel = 0;
+	}
+	memcpy(entry->bssid, bssid, MW_BSSID_LEN);
+	entry->valid = TRUE;
+	ap_cache_save(cache);
+}
+
+void dl_ap_cache_reset(uint8_t slot, uint8_t channel)
+{
+	struct dl_ap_cache cache;
+	struct dl_ap_cache_slot *entry = &cache.slot[slot];
+
+	if (ap_cache_load(&cache) || (!entry->valid &&
+				entry->channel == channel)) {
+		return;
+	}
+
+	entry->valid = FALSE;
+	entry->channel = channel;
+	ap_cache_save(&cache);
+}
+
+// Tries a targeted association to the cached AP, falls back to full scan.
+// Firmware without targeted association support performs a standard one.
+static enum mw_err ap_assoc(uint8_t slot)
+{
+	struct dl_ap_cache cache;
+	struct dl_ap_cache_slot *entry = &cache.slot[slot];
+	enum mw_err err = MW_ERR;
+	int targeted = TRUE;
+	int cache_ok;
+
+	cache_ok = !ap_cache_load(&cache);
+	if (cache_ok && entry->valid) {
+		err = mw_ap_assoc_bssid(slot, entry->bssid, entry->channel,
+				&targeted);
+		if (!err) {
+			err = mw_ap_assoc_wait(targeted ? DL_FAST_ASSOC_TOUT :
+					DL_ASSOC_TOUT);
+		}
+		if (err && targeted) {
+			mw_ap_disassoc();
+		}
+	}
+	if (err && targeted) {
+		err = mw_ap_assoc(slot);
+		if (!err) {
+			err = mw_ap_assoc_wait(DL_ASSOC_TOUT);
+		}
+	}
+	if (!err && cache_ok) {
+		ap_cache_update(&cache, slot);
+	}
+
+	return err;
+}
 
 static int reboot_cb(struct menu_entry_instance *instance)
 {
@@ -29,7 +152,8 @@ static void conn_err(struct menu_entry_instance *instance)
 
 	menu_str_replace(&item[0].caption, "Connection error!");
 	menu_str_replace(&item[2].caption, "BACK");
-	menu_item_draw(MENU_PLACE_CENTER);
+	menu_item_redraw(0);
+	menu_item_redraw(2);
 	mw_ap_disassoc();
 	context->str = ITEM_ACCEPT_STR;
 	context->length = context->max_length = sizeof(ITEM_ACCEPT_STR) - 1;
@@ -46,14 +170,10 @@ static int download_mode_menu_cb(struct menu_entry_instance *instance)
 	char ip_addr[16] = {0};
 	struct mw_ip_cfg *ip = NULL;
 
-	err = mw_ap_assoc(ap_slot);
-
+	err = ap_assoc(ap_slot);
 	if (!err) {
-		err = mw_ap_assoc_wait(39 * 60);
-		if (!err) {
-			menu_str_replace(&item[0].caption, "Connecting to server...");
-			menu_item_draw(MENU_PLACE_CENTER);
-		}
+		menu_str_replace(&item[0].caption, "Connecting to server...");
+		menu_item_redraw(0);
 	}
 	if (!err) {
 		err = mw_ip_current(&ip);
@@ -65,17 +185,16 @@ static int download_mode_menu_cb(struct menu_entry_instance *instance)
 	if (!err) {
 		menu_str_replace(&item[0].caption, "Associated. IP: ");
 		menu_str_append(&item[0].caption, ip_addr);
-		menu_item_draw(MENU_PLACE_CENTER);
+		menu_item_redraw(0);
 
 		err = mw_sock_conn_wait(SF_CHANNEL, 0);
 	}
 	if (!err) {
 		menu_str_replace(&item[0].caption, "Connected to client!");
-		menu_item_draw(MENU_PLACE_CENTER);
+		menu_item_redraw(0);
 		sf_init(cmd_buf, MW_BUFLEN, instance);
 		sf_start();
 		instance->entry->periodic_cb = NULL;
-		sound_deinit();
 //		bg_deinit();
 	}
 
@@ -110,6 +229,49 @@ const struct menu_entry download_start_menu = {
 	} MENU_ITEM_ENTRY_END
 };
 
+static int burn_menu_cb(struct menu_entry_instance *instance)
+{
+	struct menu_item *item = instance->entry->item_entry->item;
+	struct menu_str *context = &instance->entry->left_context;
+	int err;
+
+	instance->entry->periodic_cb = NULL;
+	sf_init(cmd_buf, MW_BUFLEN, instance);
+	err = sf_burn();
+
+	menu_str_replace(&item[0].caption, err ? "Burn failed!" :
+			"Done! Insert next cart to burn again");
+	menu_item_redraw(0);
+	context->str = ITEM_BACK_STR;
+	context->length = context->max_length = sizeof(ITEM_BACK_STR) - 1;
+	menu_redraw_context();
+
+	return err;
+}
+
+/// Burns the image staged in the module flash into the cartridge
+const struct menu_entry burn_menu = {
+	.type = MENU_TYPE_ITEM,
+	.margin = MENU_DEF_LEFT_MARGIN,
+	.title = MENU_STR_RO("BURN STAGED IMAGE"),
+	.left_context = MENU_STR_RO(WAIT_STR),
+	.periodic_cb = burn_menu_cb,
+	.item_entry = MENU_ITEM_ENTRY(3, 2, MENU_H_ALIGN_CENTER, 1) {
+		{
+			.caption = MENU_STR_RW("Burning staged image...", 38),
+			.not_selectable = TRUE
+		},
+		{
+			.caption = MENU_STR_NULL
+		},
+		{
+			.caption = MENU_STR_EMPTY(15),
+			.not_selectable = TRUE,
+			.alt_color = TRUE
+		}
+	} MENU_ITEM_ENTRY_END
+};
+
 static int download_menu_select_default_cb(struct menu_entry_instance *instance)
 {
 	int ap;
@@ -6,6 +6,12 @@
 extern const struct menu_entry download_menu;
 /// Starts download mode with the consfiguration selected in previous menu
 extern const struct menu_entry download_start_menu;
+/// Burns the image previously staged in the WiFi module flash
+extern const struct menu_entry burn_menu;
+
+/// Forgets the AP cached for a configuration slot, after it is changed.
+/// Channel is the one of the AP selected from a scan, 0 if unknown.
+void dl_ap_cache_reset(uint8_t slot, uint8_t channel);
 
 #endif /*_MENU_DL_H_*/
 
@@ -5,6 +5,8 @@
 #include "menu_txt.h"
 #include "menu_dl.h"
 #include "menu_gtag.h"
+#include "menu_upg.h"
+#include "menu_mem.h"
 #include "../globals.h"
 #include "../sysfsm.h"
 #include "../menu_imp/menu.h"
@@ -481,7 +483,7 @@ const struct menu_entry config_menu = {
 	.title = MENU_STR_RO("CONFIGURATION"),
 	.left_context = MENU_STR_RO(ITEM_LEFT_CTX_STR),
 	.enter_cb = config_menu_enter_cb,
-	.item_entry = MENU_ITEM_ENTRY(8, 2, MENU_H_ALIGN_LEFT, 1) {
+	.item_entry = MENU_ITEM_ENTRY(10, 2, MENU_H_ALIGN_LEFT, 1) {
 		{
 			.caption = MENU_STR_RW("1: ", 36),
 			.offset = 3,
@@ -516,9 +518,17 @@ const struct menu_entry config_menu = {
 			.caption = MENU_STR_RO("ADVANCED"),
 			.next = (struct menu_entry*)&advanced_menu
 		},
+		{
+			.caption = MENU_STR_RO("FIRMWARE UPGRADE"),
+			.next = (struct menu_entry*)&upgrade_menu
+		},
 		{
 			.caption = MENU_STR_RO("RESET TO DEFAULTS"),
 			.next = (struct menu_entry*)&defaults_menu
+		},
+		{
+			.caption = MENU_STR_RO("MEMORY STATS"),
+			.next = (struct menu_entry*)&mem_menu
 		}
 	} MENU_ITEM_ENTRY_END
 };
@@ -593,8 +603,7 @@ static int main_menu_enter_cb(struct menu_entry_instance *instance)
 
 	// If no game intalled (no valid boot addr), leave boot game
 	// entry as not selectable
-	if (!GL_ENTRY_POINT_ADDR || 0xFFFFFFFF == GL_ENTRY_POINT_ADDR ||
-			0x20202020 == GL_ENTRY_POINT_ADDR) {
+	if (!GL_ENTRY_POINT_VALID()) {
 		goto out;
 	}
 
@@ -766,7 +775,7 @@ const struct menu_entry main_menu = {
 	.title = MENU_STR_RO("MegaWiFi loader by doragasu"),
 	.left_context = MENU_STR_RO("Select an option"),
 	.enter_cb = main_menu_enter_cb,
-	.item_entry = MENU_ITEM_ENTRY(5, 4, MENU_H_ALIGN_CENTER, 1) {
+	.item_entry = MENU_ITEM_ENTRY(6, 3, MENU_H_ALIGN_CENTER, 1) {
 		{
 			.caption = MENU_STR_RW("NO GAME INSTALLED", 40),
 			.not_selectable = TRUE,
@@ -777,6 +786,10 @@ const struct menu_entry main_menu = {
 			.caption = MENU_STR_RO("DOWNLOAD MODE"),
 			.entry_cb = dl_menu_set_cb
 		},
+		{
+			.caption = MENU_STR_RO("BURN STAGED IMAGE"),
+			.next = (struct menu_entry*)&burn_menu
+		},
 		{
 			.caption = MENU_STR_RO("CONFIGURATION"),
 			.next = (struct menu_entry*)&config_menu
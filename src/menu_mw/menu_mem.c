@@ -0,0 +1,119 @@
+/************************************************************************//**
+ * \brief Memory pool statistics menu, see menu_mem.h.
+ *
+ * \author Jesús Alonso (doragasu)
+ * \date   2026
+ ****************************************************************************/
+#include "menu_mem.h"
+#include "menu_txt.h"
+#include "../loop.h"
+#include "../mpool.h"
+#include "../menu_imp/menu.h"
+#include "../util.h"
+
+/// Statistics refresh period
+#define MEM_REFRESH_FRAMES	MS_TO_FRAMES(500)
+
+/// Memory statistics menu items
+enum {
+	MENU_MEM_USED = 0,
+	MENU_MEM_PEAK,
+	MENU_MEM_FREE,
+	MENU_MEM_MIN_FREE,
+	MENU_MEM_EMPTY,
+	MENU_MEM_ALLOCS,
+	MENU_MEM_FAILED,
+	MENU_MEM_GUARD_ERR,
+	MENU_MEM_N_ENTRIES
+};
+
+static uint8_t refresh_frames;
+
+static void stat_draw(struct menu_str *caption, const char *name,
+		uint32_t value)
+{
+	char num[12];
+
+	menu_str_replace(caption, name);
+	long_to_str(value, num, sizeof(num), 0, 0);
+	menu_str_append(caption, num);
+}
+
+static void mem_stats_draw(struct menu_item *item)
+{
+	struct mp_stats stats;
+
+	mp_stats_get(&stats);
+	stat_draw(&item[MENU_MEM_USED].caption, "USED: ", stats.used);
+	stat_draw(&item[MENU_MEM_PEAK].caption, "PEAK: ", stats.peak);
+	stat_draw(&item[MENU_MEM_FREE].caption, "FREE: ", stats.free);
+	stat_draw(&item[MENU_MEM_MIN_FREE].caption, "MIN FREE: ",
+			stats.min_free);
+	stat_draw(&item[MENU_MEM_ALLOCS].caption, "ALLOCATIONS: ",
+			stats.allocs);
+	stat_draw(&item[MENU_MEM_FAILED].caption, "FAILED: ", stats.failed);
+	stat_draw(&item[MENU_MEM_GUARD_ERR].caption, "GUARD ERRORS: ",
+			stats.guard_err);
+}
+
+static int mem_enter_cb(struct menu_entry_instance *instance)
+{
+	refresh_frames = 0;
+	mem_stats_draw(instance->entry->item_entry->item);
+
+	return 0;
+}
+
+static int mem_periodic_cb(struct menu_entry_instance *instance)
+{
+	if (++refresh_frames >= MEM_REFRESH_FRAMES) {
+		refresh_frames = 0;
+		mem_stats_draw(instance->entry->item_entry->item);
+		menu_item_draw(MENU_PLACE_CENTER);
+	}
+
+	return 0;
+}
+
+const struct menu_entry mem_menu = {
+	.type = MENU_TYPE_ITEM,
+	.margin = MENU_DEF_LEFT_MARGIN,
+	.title = MENU_STR_RO("MEMORY STATS"),
+	.left_context = MENU_STR_RO(ITEM_BACK_STR),
+	.enter_cb = mem_enter_cb,
+	.periodic_cb = mem_periodic_cb,
+	.item_entry = MENU_ITEM_ENTRY(MENU_MEM_N_ENTRIES, 2, MENU_H_ALIGN_CENTER, 1) {
+		{
+			.caption = MENU_STR_EMPTY(30),
+			.not_selectable = TRUE
+		},
+		{
+			.caption = MENU_STR_EMPTY(30),
+			.not_selectable = TRUE
+		},
+		{
+			.caption = MENU_STR_EMPTY(30),
+			.not_selectable = TRUE
+		},
+		{
+			.caption = MENU_STR_EMPTY(30),
+			.not_selectable = TRUE
+		},
+		{
+			.not_selectable = TRUE,
+			.hidden = TRUE
+		},
+		{
+			.caption = MENU_STR_EMPTY(30),
+			.not_selectable = TRUE
+		},
+		{
+			.caption = MENU_STR_EMPTY(30),
+			.not_selectable = TRUE
+		},
+		{
+			.caption = MENU_STR_EMPTY(30),
+			.not_selectable = TRUE
+		}
+	} MENU_ITEM_ENTRY_END
+};
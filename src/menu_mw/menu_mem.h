@@ -0,0 +1,29 @@
+/************************************************************************//**
+ * \file
+ *
+ * \brief Memory pool statistics menu.
+ *
+ * \defgroup menu_mem menu_mem
+ * \{
+ *
+ * \brief Memory pool statistics menu.
+ *
+ * Shows the memory pool usage and allocation counters, refreshed while the
+ * menu is displayed. Guard errors are only counted when built with
+ * MP_DEBUG.
+ *
+ * \author Jesús Alonso (doragasu)
+ * \date   2026
+ ****************************************************************************/
+
+#ifndef _MENU_MEM_H_
+#define _MENU_MEM_H_
+
+#include "../menu_imp/menu_itm.h"
+
+/// Memory pool statistics (debug) menu
+extern const struct menu_entry mem_menu;
+
+#endif /*_MENU_MEM_H_*/
+
+/** \} */
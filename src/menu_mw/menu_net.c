@@ -1,6 +1,7 @@
 #include <string.h>
 #include "menu_net.h"
 #include "menu_txt.h"
+#include "menu_dl.h"
 #include "../menu_imp/menu.h"
 #include "../menu_imp/menu_msg.h"
 #include "../mw/megawifi.h"
@@ -41,6 +42,8 @@ struct menu_net_adv_data {
 struct menu_net_data {
 	struct menu_net_adv_data cfg;
 	struct menu_net_adv_data tmp;
+	uint8_t *scan_ch;	///< Channel of each scanned AP
+	uint8_t channel;	///< Channel of the selected AP, 0 if unknown
 };
 
 static const char * const security[] = {
@@ -94,6 +97,7 @@ static int net_menu_scan_sel(struct menu_entry_instance *instance)
 	// Skip "SSID: ", overwrite anything else
 	dst->caption.length = dst->offset;
 	menu_str_append(&dst->caption, ssid + 12);
+	d->channel = d->scan_ch[instance->sel_item];
 
 	// Selection complete, go back a level
 	menu_back(1);
@@ -152,7 +156,8 @@ static int net_menu_ap_scan(struct menu_entry_instance *instance)
 
 	// Allocate memory for the menu items
 	entry->item = mp_calloc(n_aps * sizeof(struct menu_item));
-	if (!entry->item) {
+	d->scan_ch = mp_alloc(n_aps);
+	if (!entry->item || !d->scan_ch) {
 		menu_msg("ERROR", "Out of memory!", 0, 60 * 5);
 		return 1;
 	}
@@ -163,6 +168,7 @@ static int net_menu_ap_scan(struct menu_entry_instance *instance)
 	for (i = 0; i < n_aps && (pos = mw_ap_fill_next(data, pos, &ap,
 					data_len)); i++) {
 		net_menu_ap_fill(i, entry, &ap);
+		d->scan_ch[i] = ap.channel;
 	}
 	return 0;
 }
@@ -412,11 +418,22 @@ const struct menu_entry net_menu_advanced = {
 	} MENU_ITEM_ENTRY_END
 };
 
+// Channel of a typed SSID is not known
+static int net_menu_ssid_typed(struct menu_entry_instance *instance)
+{
+	UNUSED_PARAM(instance);
+
+	d->channel = 0;
+
+	return 0;
+}
+
 static const struct menu_entry menu_net_ssid_osk = {
 	.type = MENU_TYPE_OSK,
 	.margin = MENU_DEF_LEFT_MARGIN,
 	.title = MENU_STR_RO("SSID"),
 	.left_context = MENU_STR_RO(QWERTY_LEFT_CTX_STR),
+	.action_cb = net_menu_ssid_typed,
 	.osk_entry = MENU_OSK_ENTRY {
 		.caption = MENU_STR_RO("Enter network SSID:"),
 		.osk_type = MENU_TYPE_OSK_QWERTY,
@@ -452,6 +469,7 @@ static int net_menu_save(struct menu_entry_instance *instance)
 		menu_msg("ERROR", "Failed to save configuration!", 0, 60 * 5);
 		return 1;
 	}
+	dl_ap_cache_reset(slot, d->channel);
 
 	return 0;
 }
@@ -468,6 +486,7 @@ static int net_menu_enter_cb(struct menu_entry_instance *instance)
 
 	// Will be automatically freed on menu exit
 	d = mp_alloc(sizeof(struct menu_net_data));
+	d->channel = 0;
 
 	// Get AP config
 	d->cfg.phy = MENU_NET_PHY_DEFAULT;
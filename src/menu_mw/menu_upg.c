@@ -0,0 +1,227 @@
+#include <string.h>
+#include "menu_upg.h"
+#include "menu_txt.h"
+#include "../globals.h"
+#include "../sysfsm.h"
+#include "../loop.h"
+#include "../menu_imp/menu.h"
+#include "../menu_imp/menu_msg.h"
+#include "../mw/megawifi.h"
+#include "../util.h"
+
+/// Maximum firmware name length
+#define UPG_NAME_MAXLEN		32
+
+/// Maximum number of frames the upgrade can take
+#define UPG_TOUT_FRAMES		MS_TO_FRAMES(MW_UPGRADE_TOUT_MS)
+
+/// Firmware upgrade menu items
+enum {
+	MENU_UPG_NAME_CAPTION = 0,
+	MENU_UPG_NAME,
+	MENU_UPG_EMPTY1,
+	MENU_UPG_START,
+	MENU_UPG_EMPTY2,
+	MENU_UPG_PROGRESS,
+	MENU_UPG_RATE,
+	MENU_UPG_N_ENTRIES
+};
+
+/// Upgrade status, filled by the module callback and drawn by the menu
+static struct {
+	uint32_t done;
+	uint32_t total;
+	uint16_t frames;
+	enum mw_upgrade_stat stat;
+	uint8_t active:1;
+	uint8_t updated:1;
+	uint8_t reboot:1;
+} upg;
+
+static const struct menu_entry menu_upg_name_osk = {
+	.type = MENU_TYPE_OSK,
+	.margin = MENU_DEF_LEFT_MARGIN,
+	.title = MENU_STR_RO("FIRMWARE NAME"),
+	.left_context = MENU_STR_RO(QWERTY_LEFT_CTX_STR),
+	.osk_entry = MENU_OSK_ENTRY {
+		.caption = MENU_STR_RO("Firmware (e.g. mw_rtos_std_v1.4):"),
+		.osk_type = MENU_TYPE_OSK_QWERTY,
+		.line_len = UPG_NAME_MAXLEN - 1
+	}
+};
+
+static void upg_reboot(void)
+{
+	extern uint32_t dirty_dw;
+
+	// Make sure we boot the loader again
+	dirty_dw = MAGIC_WIFI_CONFIG;
+	sf_boot(GL_BOOTLOADER_ADDR, TRUE);
+}
+
+// Runs from the module, just record progress for the menu to draw it
+static void upg_cb(enum mw_upgrade_stat stat, uint32_t done,
+		uint32_t total, uint16_t frames)
+{
+	upg.stat = stat;
+	upg.done = done;
+	upg.total = total;
+	upg.frames = frames;
+	upg.updated = TRUE;
+	if (MW_UPGRADE_IN_PROGRESS != stat) {
+		upg.active = FALSE;
+	}
+}
+
+static void upg_progress_draw(struct menu_item *item)
+{
+	struct menu_str *progress = &item[MENU_UPG_PROGRESS].caption;
+	struct menu_str *rate = &item[MENU_UPG_RATE].caption;
+	char num[12];
+
+	if (!upg.done && !upg.total) {
+		// Firmware without progress reports only replies when done,
+		// show the elapsed time meanwhile
+		menu_str_replace(progress, "IN PROGRESS: ");
+		long_to_str(upg.frames / FPS, num, sizeof(num), 0, 0);
+		menu_str_append(progress, num);
+		menu_str_append(progress, " S");
+		menu_item_draw(MENU_PLACE_CENTER);
+		return;
+	}
+	if (upg.total) {
+		menu_str_replace(progress, "PROGRESS: ");
+		long_to_str(upg.done * 100 / upg.total, num, sizeof(num),
+				0, 0);
+		menu_str_append(progress, num);
+		menu_str_append(progress, "%");
+	} else {
+		menu_str_replace(progress, "RECEIVED: ");
+		long_to_str(upg.done, num, sizeof(num), 0, 0);
+		menu_str_append(progress, num);
+		menu_str_append(progress, " BYTES");
+	}
+	if (upg.frames) {
+		menu_str_replace(rate, "RATE: ");
+		long_to_str(upg.done * FPS / upg.frames, num, sizeof(num),
+				0, 0);
+		menu_str_append(rate, num);
+		menu_str_append(rate, " B/S");
+	}
+	menu_item_draw(MENU_PLACE_CENTER);
+}
+
+static int upg_periodic_cb(struct menu_entry_instance *instance)
+{
+	struct menu_item *item = instance->entry->item_entry->item;
+
+	if (upg.reboot) {
+		upg_reboot();
+	}
+	if (!upg.updated) {
+		return 0;
+	}
+
+	upg.updated = FALSE;
+	upg_progress_draw(item);
+	switch (upg.stat) {
+	case MW_UPGRADE_DONE:
+		menu_msg("UPGRADE COMPLETE", "Press button to reboot", 0, 0);
+		upg.reboot = TRUE;
+		break;
+
+	case MW_UPGRADE_ERROR:
+		menu_msg("UPGRADE FAILED", "Press button to reboot", 0, 0);
+		upg.reboot = TRUE;
+		break;
+
+	case MW_UPGRADE_TIMEOUT:
+		menu_msg("UPGRADE TIMED OUT", "Press button to reboot", 0, 0);
+		upg.reboot = TRUE;
+		break;
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static int upg_start_cb(struct menu_entry_instance *instance)
+{
+	struct menu_item *item = instance->entry->item_entry->item;
+	struct menu_str *name = &item[MENU_UPG_NAME].caption;
+
+	if (upg.active) {
+		return 1;
+	}
+	if (!name->length) {
+		menu_msg("INVALID INPUT", "Enter the firmware name", 0, 0);
+		return 1;
+	}
+
+	memset(&upg, 0, sizeof(upg));
+	if (mw_fw_upgrade_start(name->str, UPG_TOUT_FRAMES, upg_cb)) {
+		menu_msg("UPGRADE ERROR", "Failed to start upgrade", 0, 0);
+		return 1;
+	}
+	upg.active = TRUE;
+	menu_str_replace(&item[MENU_UPG_PROGRESS].caption, "STARTING...");
+	menu_item_draw(MENU_PLACE_CENTER);
+
+	return 0;
+}
+
+static int upg_exit_cb(struct menu_entry_instance *instance)
+{
+	UNUSED_PARAM(instance);
+
+	if (upg.active) {
+		// Module is reset on abort, reboot to start over
+		mw_fw_upgrade_abort();
+		upg_reboot();
+	}
+
+	return 0;
+}
+
+const struct menu_entry upgrade_menu = {
+	.type = MENU_TYPE_ITEM,
+	.margin = MENU_DEF_LEFT_MARGIN,
+	.title = MENU_STR_RO("FIRMWARE UPGRADE"),
+	.left_context = MENU_STR_RO(ITEM_LEFT_CTX_STR),
+	.periodic_cb = upg_periodic_cb,
+	.exit_cb = upg_exit_cb,
+	.item_entry = MENU_ITEM_ENTRY(MENU_UPG_N_ENTRIES, 2, MENU_H_ALIGN_CENTER, 1) {
+		{
+			.caption = MENU_STR_RO("FIRMWARE NAME:"),
+			.not_selectable = TRUE,
+			.alt_color = TRUE
+		},
+		{
+			.caption = MENU_STR_EMPTY(UPG_NAME_MAXLEN),
+			.draw_empty = TRUE,
+			.next = (struct menu_entry*)&menu_upg_name_osk
+		},
+		{
+			.not_selectable = TRUE,
+			.hidden = TRUE
+		},
+		{
+			.caption = MENU_STR_RO("UPGRADE!"),
+			.entry_cb = upg_start_cb
+		},
+		{
+			.not_selectable = TRUE,
+			.hidden = TRUE
+		},
+		{
+			.caption = MENU_STR_EMPTY(30),
+			.not_selectable = TRUE
+		},
+		{
+			.caption = MENU_STR_EMPTY(30),
+			.not_selectable = TRUE
+		}
+	} MENU_ITEM_ENTRY_END
+};
@@ -0,0 +1,9 @@
+#ifndef _MENU_UPG_H_
+#define _MENU_UPG_H_
+
+#include "../menu_imp/menu_itm.h"
+
+/// WiFi module firmware upgrade menu
+extern const struct menu_entry upgrade_menu;
+
+#endif /*_MENU_UPG_H_*/
@@ -1,6 +1,7 @@
 #include <string.h>
 
 #include "mpool.h"
+#include "util.h"
 
 #define MP_ALIGN_MASK	(MP_ALIGN - 1)
 
@@ -17,14 +18,55 @@ extern uint8_t _eflash;
 #define MP_ALIGN_COMP(addr)	(uint8_t*)(((((uint32_t)(addr)) + MP_ALIGN_MASK) \
 			& (~((uint32_t)MP_ALIGN_MASK))))
 
+/// Bytes kept free between the pool and the stack pointer
+#define MP_STACK_MARGIN		256
+
+#ifdef MP_DEBUG
+/// Value of the guard words
+#define MP_GUARD_MAGIC		0x6D47A2D5
+
+/// Guard placed after each allocated block
+struct mp_guard {
+	uint32_t magic;
+	struct mp_guard *prev;	///< Guard of the previous block
+};
+
+#define MP_GUARD_LEN		sizeof(struct mp_guard)
+#else
+#define MP_GUARD_LEN		0
+#endif
+
 typedef struct {
 	uint8_t *floor;
 	uint8_t *pos;
+	struct mp_arena *arena;
+	/// Last stack pointer value seen outside pool allocated stacks
+	uint8_t *sp;
+#ifdef MP_DEBUG
+	struct mp_guard *guard;
+#endif
+	uint32_t peak;
+	uint32_t min_free;
+	uint16_t allocs;
+	uint16_t failed;
+	uint16_t guard_err;
+	uint8_t depth;
     uint8_t init_done;
 } mp_data;
 
 /// Local module data
-mp_data md = {0, 0, 0};
+mp_data md = {};
+
+// Returns the stack pointer, or NULL if using a stack allocated from the
+// pool (e.g. loop tasks)
+static uint8_t *stack_get(void)
+{
+	uint8_t *sp;
+
+	__asm__ volatile ("move.l %%sp, %0" : "=r"(sp));
+
+	return sp > md.pos ? sp : NULL;
+}
 
 void mp_init(int force_init)
 {
@@ -32,27 +74,70 @@ void mp_init(int force_init)
     	// Ensure the origin is aligned and initialize current position
     	md.floor = MP_ALIGN_COMP(&_eflash);
     	md.pos = md.floor;
+	md.arena = NULL;
+	md.depth = 0;
+	md.sp = stack_get();
+	md.peak = 0;
+	md.min_free = md.sp - md.pos;
+	md.allocs = md.failed = md.guard_err = 0;
+#ifdef MP_DEBUG
+	md.guard = NULL;
+#endif
         md.init_done = 1;
     }
 }
 
-void *mp_alloc(uint16_t length)
+void *mp_alloc_aligned(uint32_t length, uint32_t align, uint32_t boundary)
 {
-	void *tmp, *ret;
+	uint8_t *tmp, *ret, *sp;
 
 	// Adjust length depending on alignmentnforcement
 	length = (length + MP_ALIGN_MASK) & ~MP_ALIGN_MASK;
+	align = MAX(align, MP_ALIGN);
+	ret = (uint8_t*)(((uint32_t)md.pos + align - 1) & ~(align - 1));
+	// If the block crosses a boundary, start it on the boundary
+	if (boundary && length && (((uint32_t)ret ^
+				((uint32_t)ret + length - 1)) & ~(boundary - 1))) {
+		ret = (uint8_t*)(((uint32_t)ret + boundary - 1) &
+				~(boundary - 1));
+	}
 
-	// Check there is enough room
-	tmp = length + md.pos;
-	if (tmp >= MP_POOL_END) return NULL;
-	ret = md.pos;
+	// Check there is enough room, also before the stack
+	sp = stack_get();
+	if (sp) {
+		md.sp = sp;
+	}
+	if ((boundary && length > boundary) || ret >= (uint8_t*)MP_POOL_END ||
+			length + MP_GUARD_LEN >=
+			(uint32_t)((uint8_t*)MP_POOL_END - ret)) {
+		md.failed++;
+		return NULL;
+	}
+	tmp = ret + length + MP_GUARD_LEN;
+	if (tmp + MP_STACK_MARGIN > md.sp) {
+		md.failed++;
+		return NULL;
+	}
 	md.pos = tmp;
+#ifdef MP_DEBUG
+	struct mp_guard *guard = (struct mp_guard*)(ret + length);
+	guard->magic = MP_GUARD_MAGIC;
+	guard->prev = md.guard;
+	md.guard = guard;
+#endif
+	md.allocs++;
+	md.peak = MAX(md.peak, (uint32_t)(md.pos - md.floor));
+	md.min_free = MIN(md.min_free, (uint32_t)(md.sp - md.pos));
 
 	return ret;
 }
 
-void *mp_calloc(uint16_t length)
+void *mp_alloc(uint32_t length)
+{
+	return mp_alloc_aligned(length, MP_ALIGN, 0);
+}
+
+void *mp_calloc(uint32_t length)
 {
 	void *mem = mp_alloc(length);;
 	
@@ -61,10 +146,137 @@ void *mp_calloc(uint16_t length)
 	return mem;
 }
 
+#ifdef MP_DEBUG
+// Check guards down to pos, returns the first guard below it
+static struct mp_guard *guards_check(void *pos, uint16_t *errors)
+{
+	struct mp_guard *guard = md.guard;
+
+	while (guard && (void*)guard >= pos) {
+		if (MP_GUARD_MAGIC != guard->magic) {
+			// Previous guard pointer cannot be trusted
+			(*errors)++;
+			return NULL;
+		}
+		guard = guard->prev;
+	}
+
+	return guard;
+}
+
+uint16_t mp_check(void)
+{
+	uint16_t errors = 0;
+
+	guards_check(md.floor, &errors);
+
+	return errors;
+}
+#endif
+
 void mp_free_to(void *pos)
 {
 	// Check pos looks valid, and set it if affirmative
 	if ((pos >= (void*)md.floor) && (pos < (void*)md.pos) &&
-			(pos == MP_ALIGN_COMP(pos))) md.pos = pos;
+			(pos == MP_ALIGN_COMP(pos))) {
+#ifdef MP_DEBUG
+		md.guard = guards_check(pos, &md.guard_err);
+#endif
+		md.pos = pos;
+	}
+}
+
+void mp_stats_get(struct mp_stats *stats)
+{
+	uint8_t *sp = stack_get();
+
+	if (sp) {
+		md.sp = sp;
+	}
+	stats->used = md.pos - md.floor;
+	stats->peak = md.peak;
+	stats->free = md.sp - md.pos;
+	stats->min_free = md.min_free;
+	stats->allocs = md.allocs;
+	stats->failed = md.failed;
+	stats->guard_err = md.guard_err;
+}
+
+
+void mp_arena_mark(struct mp_arena *arena, const char *name)
+{
+	arena->name = name;
+	arena->mark = md.pos;
+	arena->prev = md.arena;
+	arena->depth = ++md.depth;
+	md.arena = arena;
+}
+
+void mp_arena_release(struct mp_arena *arena)
+{
+	struct mp_arena *open = md.arena;
+
+	// Already released, directly or by releasing an older arena
+	if (!arena->depth || arena->depth > md.depth) {
+		return;
+	}
+	// A stale handle can match the depth of an arena marked later, so
+	// it must also be the open arena at that depth
+	while (open && open->depth > arena->depth) {
+		open = open->prev;
+	}
+	if (open != arena) {
+		return;
+	}
+
+	md.depth = arena->depth - 1;
+	md.arena = arena->prev;
+	mp_free_to(arena->mark);
+}
+
+int mp_block_pool_init(struct mp_block_pool *pool, uint16_t block_len,
+		uint16_t blocks)
+{
+	uint32_t length;
+	uint8_t *block;
+
+	block_len = (MAX(block_len, sizeof(void*)) + MP_ALIGN_MASK) &
+		~MP_ALIGN_MASK;
+	length = (uint32_t)block_len * blocks;
+	if (!(block = mp_alloc(length))) {
+		return 1;
+	}
+
+	pool->block_len = block_len;
+	pool->blocks = blocks;
+	pool->used = 0;
+	pool->free = NULL;
+	// Build the free list, so blocks are allocated in address order
+	block += length;
+	while (blocks--) {
+		block -= block_len;
+		*(void**)block = pool->free;
+		pool->free = block;
+	}
+
+	return 0;
+}
+
+void *mp_block_alloc(struct mp_block_pool *pool)
+{
+	void *block = pool->free;
+
+	if (block) {
+		pool->free = *(void**)block;
+		pool->used++;
+	}
+
+	return block;
 }
 
+void mp_block_free(struct mp_block_pool *pool, void *block)
+{
+	*(void**)block = pool->free;
+	pool->free = block;
+	pool->used--;
+}
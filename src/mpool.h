@@ -17,6 +17,23 @@
  * requested it (it does not allow generic allocate/free such as malloc()
  * does).
  *
+ * To make this LIFO usage explicit, allocations can be grouped in named
+ * scoped arenas: mp_arena_mark() opens an arena at the current pool
+ * position, and mp_arena_release() frees everything allocated since then,
+ * including the memory of arenas opened inside it. Arenas must be released
+ * in reverse order of marking (e.g. one arena per menu level or per
+ * transfer session).
+ *
+ * Objects that are frequently allocated and freed in any order can use
+ * fixed size block pools. A block pool takes its memory from the pool once,
+ * on mp_block_pool_init(), and then allocates and frees blocks in constant
+ * time, using a free list.
+ *
+ * Allocations fail if they would get closer than 256 bytes to the stack
+ * pointer. Usage statistics are available through mp_stats_get(). Defining
+ * MP_DEBUG places a guard after each allocated block, and guards are
+ * checked when memory is freed with mp_free_to().
+ *
  * \author doragasu
  * \date   2017
  ****************************************************************************/
@@ -30,6 +47,33 @@
 /// Memory alignment enforcement (in bytes). Must be a power of 2
 #define MP_ALIGN			4
 
+/// Pool usage statistics, see mp_stats_get()
+struct mp_stats {
+	uint32_t used;		///< Bytes currently allocated
+	uint32_t peak;		///< Maximum bytes allocated at the same time
+	uint32_t free;		///< Bytes between the pool and the stack
+	uint32_t min_free;	///< Minimum free bytes after an allocation
+	uint16_t allocs;	///< Successful allocations (wraps around)
+	uint16_t failed;	///< Failed allocations (wraps around)
+	uint16_t guard_err;	///< Corrupted guards found (MP_DEBUG builds)
+};
+
+/// Scoped arena, do not manually modify its fields
+struct mp_arena {
+	const char *name;	///< Arena name
+	void *mark;		///< Pool position when the arena was marked
+	struct mp_arena *prev;	///< Arena marked before this one
+	uint8_t depth;		///< Number of open arenas, including this one
+};
+
+/// Fixed size block pool, do not manually modify its fields
+struct mp_block_pool {
+	void *free;		///< First free block
+	uint16_t block_len;	///< Length of each block
+	uint16_t blocks;	///< Number of blocks
+	uint16_t used;		///< Number of allocated blocks
+};
+
 /************************************************************************//**
  * \brief Pool initialization.
  *
@@ -50,10 +94,28 @@ void mp_init(int force_init);
  *
  * \return Pointer to the allocated memory zone of the requested length, or
  * NULL if the allocation could not succeed.
+ ****************************************************************************/
+void *mp_alloc(uint32_t length) __attribute__((malloc));
+
+/************************************************************************//**
+ * \brief Allocates data from the pool, with alignment and boundary
+ * constraints.
+ *
+ * Memory skipped to satisfy the constraints is lost until it is freed
+ * along with the block.
+ *
+ * \param[in] length   Length of the contiguous section to allocate.
+ * \param[in] align    Alignment of the block start. Must be a power of 2.
+ *                     Values lower than MP_ALIGN use MP_ALIGN.
+ * \param[in] boundary The block does not cross an address multiple of this
+ *                     value (e.g. VDP_DMA_BOUNDARY for DMA sources). Must
+ *                     be a power of 2, or 0 for no boundary constraint.
  *
- * \todo Maybe allocation should be tested against the stack pointer
+ * \return Pointer to the allocated memory zone of the requested length, or
+ * NULL if the allocation could not succeed.
  ****************************************************************************/
-void *mp_alloc(uint16_t length) __attribute__((malloc));
+void *mp_alloc_aligned(uint32_t length, uint32_t align, uint32_t boundary)
+	__attribute__((malloc));
 
 /************************************************************************//**
  * \brief Allocates and zero fills data from the pool.
@@ -65,10 +127,8 @@ void *mp_alloc(uint16_t length) __attribute__((malloc));
  *
  * \return Pointer to the allocated memory zone of the requested length, or
  * NULL if the allocation could not succeed.
- *
- * \todo Maybe allocation should be tested against the stack pointer
  ****************************************************************************/
-void *mp_calloc(uint16_t length) __attribute__((malloc));
+void *mp_calloc(uint32_t length) __attribute__((malloc));
 
 /************************************************************************//**
  * \brief Free memory up to the one pointed by pos.
@@ -92,6 +152,78 @@ void *mp_calloc(uint16_t length) __attribute__((malloc));
  ****************************************************************************/
 void mp_free_to(void *pos);
 
+/************************************************************************//**
+ * \brief Get pool usage statistics.
+ *
+ * \param[out] stats Pool usage statistics.
+ *
+ * \note Stack is measured on allocations and on calls to this function, so
+ * free bytes do not account for deeper stack usage between them.
+ ****************************************************************************/
+void mp_stats_get(struct mp_stats *stats);
+
+#ifdef MP_DEBUG
+/************************************************************************//**
+ * \brief Check the guards of all the allocated blocks.
+ *
+ * \return Number of corrupted guards found. Guards below a corrupted one
+ * cannot be checked.
+ ****************************************************************************/
+uint16_t mp_check(void);
+#endif
+
+/************************************************************************//**
+ * \brief Open a scoped arena at the current pool position.
+ *
+ * \param[in] arena Arena to open. Must be valid until released.
+ * \param[in] name  Arena name, for debugging purposes.
+ ****************************************************************************/
+void mp_arena_mark(struct mp_arena *arena, const char *name);
+
+/************************************************************************//**
+ * \brief Release an arena, freeing all the memory allocated since it was
+ * marked.
+ *
+ * Arenas marked after this one (and not released yet) are also released.
+ * Releasing an arena that is not open (already released, directly or by
+ * releasing an older arena) does nothing.
+ *
+ * \param[in] arena Arena to release.
+ *
+ * \note The arena can be stored in memory allocated inside it.
+ ****************************************************************************/
+void mp_arena_release(struct mp_arena *arena);
+
+/************************************************************************//**
+ * \brief Initialize a fixed size block pool, allocating its memory.
+ *
+ * \param[in] pool      Block pool to initialize.
+ * \param[in] block_len Length of each block. It is rounded up to MP_ALIGN.
+ * \param[in] blocks    Number of blocks.
+ *
+ * \return 0 on success, 1 if there is not enough memory.
+ ****************************************************************************/
+int mp_block_pool_init(struct mp_block_pool *pool, uint16_t block_len,
+		uint16_t blocks);
+
+/************************************************************************//**
+ * \brief Allocate a block from a block pool.
+ *
+ * \param[in] pool Block pool.
+ *
+ * \return Pointer to the allocated block, or NULL if there are no free
+ * blocks.
+ ****************************************************************************/
+void *mp_block_alloc(struct mp_block_pool *pool) __attribute__((malloc));
+
+/************************************************************************//**
+ * \brief Return a block to its block pool.
+ *
+ * \param[in] pool  Block pool the block was allocated from.
+ * \param[in] block Block to free.
+ ****************************************************************************/
+void mp_block_free(struct mp_block_pool *pool, void *block);
+
 /************************************************************************//**
  * \brief Frees all the memory previously requested. 
  *
@@ -234,6 +234,11 @@ void lsd_process(void)
 	} while(active);
 }
 
+int lsd_busy(void)
+{
+	return d.rx.stat > LSD_RECV_IDLE || d.tx.stat > LSD_SEND_IDLE;
+}
+
 void lsd_init(void)
 {
 	uart_init();
@@ -174,6 +174,13 @@ enum lsd_status lsd_recv_sync(char *buf, uint16_t *len, uint8_t *ch);
  ****************************************************************************/
 void lsd_process(void);
 
+/************************************************************************//**
+ * \brief Check if there are sends/receives in progress.
+ *
+ * \return TRUE if lsd_process() has work to do, FALSE otherwise.
+ ****************************************************************************/
+int lsd_busy(void);
+
 /************************************************************************//**
  * \brief Sends syncrhonization frame.
  *
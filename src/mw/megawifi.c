@@ -14,6 +14,7 @@
 #include "megawifi.h"
 #include "../util.h"
 #include "../loop.h"
+#include "../mpool.h"
 
 #define MW_COMMAND_TOUT		MS_TO_FRAMES(MW_COMMAND_TOUT_MS)
 #define MW_SCAN_TOUT		MS_TO_FRAMES(MW_SCAN_TOUT_MS)
@@ -41,15 +42,25 @@ struct recv_metadata {
 struct mw_data {
 	mw_cmd *cmd;
 	lsd_recv_cb cmd_data_cb;
+	mw_upgrade_cb upgrade_cb;
 	struct loop_timer timer;
+	struct loop_wait wait;
+	struct loop_wait lock;
+	uint32_t upg_done;
+	uint32_t upg_total;
 	uint16_t buf_len;
+	uint16_t frame_len;
 	int16_t tout_frames;
+	uint16_t elapsed;
 	union {
-		uint8_t flags;
+		uint16_t flags;
 		struct {
-			uint8_t mw_ready:1;
-			uint8_t stat_poll:1;
-			uint8_t monitor_ch:4;
+			uint16_t mw_ready:1;
+			uint16_t stat_poll:1;
+			uint16_t monitor_ch:4;
+			uint16_t upgrading:1;
+			uint16_t no_stream:1;
+			uint16_t cmd_busy:1;
 		};
 	};
 };
@@ -60,15 +71,29 @@ static struct mw_data d = {};
 
 void cmd_tout_cb(struct loop_timer *t);
 
+// Command replies can use the negotiated frame length
+static inline void cmd_reply_recv(void *ctx, lsd_recv_cb recv_cb)
+{
+	lsd_recv(d.cmd->packet, d.frame_len, ctx, recv_cb);
+}
+
 int mw_init(char *cmd_buf, uint16_t buf_len)
 {
-	if (!cmd_buf || buf_len < MW_CMD_MIN_BUFLEN) {
+	if (buf_len < MW_CMD_MIN_BUFLEN) {
 		return MW_ERR_BUFFER_TOO_SHORT;
 	}
+	if (!cmd_buf) {
+		cmd_buf = mp_alloc(buf_len);
+		if (!cmd_buf) {
+			return MW_ERR_BUFFER_TOO_SHORT;
+		}
+	}
 
 	memset(&d, 0, sizeof(struct mw_data));
 	d.cmd = (mw_cmd*)cmd_buf;
 	d.buf_len = buf_len;
+	// Until a bigger length is negotiated, use the standard frame length
+	d.frame_len = MIN(buf_len, MW_MSG_MAX_BUFLEN);
 	d.timer.timer_cb = cmd_tout_cb;
 	loop_timer_add(&d.timer);
 
@@ -99,9 +124,9 @@ static void cmd_send_cb(enum lsd_status err, void *ctx)
 
 	loop_timer_stop(&d.timer);
 	if (!err) {
-		loop_post(CMD_OK);
+		loop_wake(&d.wait, CMD_OK);
 	} else {
-		loop_post(CMD_ERR_PROTO);
+		loop_wake(&d.wait, CMD_ERR_PROTO);
 	}
 }
 
@@ -115,9 +140,9 @@ static void cmd_recv_cb(enum lsd_status err, uint8_t ch,
 	if (!err) {
 		md->ch = ch;
 		md->len = len;
-		loop_post(CMD_OK);
+		loop_wake(&d.wait, CMD_OK);
 	} else {
-		loop_post(CMD_ERR_PROTO);
+		loop_wake(&d.wait, CMD_ERR_PROTO);
 	}
 }
 
@@ -125,29 +150,36 @@ void cmd_tout_cb(struct loop_timer *t)
 {
 	UNUSED_PARAM(t);
 
-	loop_post(CMD_ERR_TIMEOUT);
+	loop_wake(&d.wait, CMD_ERR_TIMEOUT);
 }
 
-static enum mw_err mw_command(int timeout_frames)
+// The command buffer, timer and wait object are shared, so only one task
+// can be sending a command or waiting for a reply. The lock is taken before
+// filling the command buffer, and released when the reply arrives.
+static void cmd_lock(void)
+{
+	while (d.cmd_busy) {
+		loop_wait(&d.lock);
+	}
+	d.cmd_busy = TRUE;
+}
+
+static void cmd_unlock(void)
+{
+	d.cmd_busy = FALSE;
+	loop_wake(&d.lock, CMD_OK);
+}
+
+static enum mw_err cmd_reply_wait(int timeout_frames)
 {
 	struct recv_metadata md;
 	int stat;
 	int done = FALSE;
 
-//	mw_cmd_send(d.cmd, NULL, cmd_send_cb);
-	/// \todo Optimization: maybe we do not need to wait for the send
-	/// process to complete, just jump to reception.
-	mw_cmd_send(d.cmd, NULL, NULL);
-//	loop_timer_start(&d.timer, timeout_frames);
-//	stat = loop_pend();
-//	if (CMD_OK != stat) {
-//		return MW_ERR_SEND;
-//	}
-
 	while (!done) {
-		mw_cmd_recv(d.cmd, &md, cmd_recv_cb);
+		cmd_reply_recv(&md, cmd_recv_cb);
 		loop_timer_start(&d.timer, timeout_frames);
-		stat = loop_pend();
+		stat = loop_wait(&d.wait);
 		if (CMD_OK != stat) {
 			return MW_ERR_RECV;
 		}
@@ -167,17 +199,79 @@ static enum mw_err mw_command(int timeout_frames)
 	return MW_ERR_NONE;
 }
 
+// Sends the command and waits for the reply, keeping the lock
+static enum mw_err cmd_run(int timeout_frames)
+{
+	if (d.upgrading) {
+		return MW_ERR_NOT_READY;
+	}
+
+//	mw_cmd_send(d.cmd, NULL, cmd_send_cb);
+	/// \todo Optimization: maybe we do not need to wait for the send
+	/// process to complete, just jump to reception.
+	mw_cmd_send(d.cmd, NULL, NULL);
+//	loop_timer_start(&d.timer, timeout_frames);
+//	stat = loop_wait(&d.wait);
+//	if (CMD_OK != stat) {
+//		return MW_ERR_SEND;
+//	}
+
+	return cmd_reply_wait(timeout_frames);
+}
+
+// Reply data is read from the command buffer right after returning, before
+// waiting on anything that would let another task send a command
+static enum mw_err mw_command(int timeout_frames)
+{
+	enum mw_err err = cmd_run(timeout_frames);
+
+	cmd_unlock();
+
+	return err;
+}
+
+uint16_t mw_frame_len_set(uint16_t frame_len)
+{
+	enum mw_err err;
+
+	if (!d.mw_ready) {
+		return d.frame_len;
+	}
+
+	// lsd_recv() requires buffer length to be lower than LSD_MAX_LEN
+	frame_len = MIN(frame_len, MIN(d.buf_len, LSD_MAX_LEN - 1));
+	cmd_lock();
+	d.cmd->cmd = MW_CMD_FRAME_LEN_SET;
+	d.cmd->data_len = sizeof(uint16_t);
+	d.cmd->frame_len = frame_len;
+	err = mw_command(MW_COMMAND_TOUT);
+	// Firmware not supporting the command keeps the standard length
+	if (!err && d.cmd->frame_len >= MW_CMD_MIN_BUFLEN &&
+			d.cmd->frame_len <= frame_len) {
+		d.frame_len = d.cmd->frame_len;
+	}
+
+	return d.frame_len;
+}
+
+uint16_t mw_cmd_data_max(void)
+{
+	return d.frame_len - MW_CMD_HEADLEN;
+}
+
 enum mw_err mw_recv_sync(uint8_t *ch, char *buf, int16_t *buf_len,
 		uint16_t tout_frames)
 {
 	struct recv_metadata md;
 	int stat;
 
+	cmd_lock();
 	lsd_recv(buf, *buf_len, &md, cmd_recv_cb);
 	if (tout_frames) {
 		loop_timer_start(&d.timer, tout_frames);
 	}
-	stat = loop_pend();
+	stat = loop_wait(&d.wait);
+	cmd_unlock();
 	if (CMD_OK != stat) {
 		return MW_ERR_RECV;
 	}
@@ -194,21 +288,29 @@ enum mw_err mw_send_sync(uint8_t ch, const char *data, uint16_t len,
 	uint16_t to_send;
 	int stat;
 	uint16_t sent = 0;
+	enum mw_err err = MW_ERR_NONE;
 
-	while (sent < len) {
+	cmd_lock();
+	while (!err && sent < len) {
 		to_send = MIN(len - sent, d.buf_len);
 		lsd_send(ch, data + sent, to_send, NULL, cmd_send_cb);
 		if (tout_frames) {
 			loop_timer_start(&d.timer, tout_frames);
 		}
-		stat = loop_pend();
+		stat = loop_wait(&d.wait);
 		if (CMD_OK != stat) {
-			return MW_ERR_SEND;
+			err = MW_ERR_SEND;
 		}
 		sent += to_send;
 	}
+	cmd_unlock();
 
-	return MW_ERR_NONE;
+	return err;
+}
+
+void mw_cmd_data_cb_set(lsd_recv_cb cmd_recv_cb)
+{
+	d.cmd_data_cb = cmd_recv_cb;
 }
 
 enum mw_err mw_detect(uint8_t *major, uint8_t *minor, char **variant)
@@ -218,11 +320,13 @@ enum mw_err mw_detect(uint8_t *major, uint8_t *minor, char **variant)
 	uint8_t version[3];
 
 	// Wait a bit and take module out of resest
+	cmd_lock();
 	loop_timer_start(&d.timer, MS_TO_FRAMES(30));
-	loop_pend();
+	loop_wait(&d.wait);
 	mw_module_start();
 	loop_timer_start(&d.timer, MS_TO_FRAMES(1000));
-	loop_pend();
+	loop_wait(&d.wait);
+	cmd_unlock();
 
 	do {
 		retries--;
@@ -250,6 +354,7 @@ enum mw_err mw_version_get(uint8_t version[3], char **variant)
 		return MW_ERR_NOT_READY;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_VERSION;
 	d.cmd->data_len = 0;
 	err = mw_command(MW_COMMAND_TOUT);
@@ -281,6 +386,7 @@ char *mw_echo(const char *data, int *len)
 	}
 
 	// Try sending and receiving echo
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_ECHO;
 	d.cmd->data_len = *len;
 	memcpy(d.cmd->data, data, *len);
@@ -301,6 +407,7 @@ enum mw_err mw_default_cfg_set(void)
 		return MW_ERR_NOT_READY;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_DEF_CFG_SET;
 	d.cmd->data_len = 4;
 	d.cmd->dw_data[0] = 0xFEAA5501;
@@ -328,6 +435,7 @@ enum mw_err mw_ap_cfg_set(uint8_t slot, const char *ssid, const char *pass,
 		return MW_ERR_PARAM;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_AP_CFG;
 	d.cmd->data_len = sizeof(struct mw_msg_ap_cfg);
 
@@ -361,6 +469,7 @@ enum mw_err mw_ap_cfg_get(uint8_t slot, char **ssid, char **pass,
 		return MW_ERR_PARAM;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_AP_CFG_GET;
 	d.cmd->data_len = 1;
 	d.cmd->data[0] = slot;
@@ -393,6 +502,7 @@ enum mw_err mw_ip_cfg_set(uint8_t slot, const struct mw_ip_cfg *ip)
 		return MW_ERR_PARAM;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_IP_CFG;
 	d.cmd->data_len = sizeof(struct mw_msg_ip_cfg);
 	d.cmd->ip_cfg.cfg_slot = slot;
@@ -416,6 +526,7 @@ enum mw_err mw_ip_cfg_get(uint8_t slot, struct mw_ip_cfg **ip)
 		return MW_ERR_NOT_READY;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_IP_CFG_GET;
 	d.cmd->data_len = 1;
 	d.cmd->data[0] = slot;
@@ -437,6 +548,7 @@ enum mw_err mw_ip_current(struct mw_ip_cfg **ip)
 		return MW_ERR_NOT_READY;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_IP_CURRENT;
 	d.cmd->data_len = 0;
 	err = mw_command(MW_COMMAND_TOUT);
@@ -457,6 +569,7 @@ int mw_ap_scan(enum mw_phy_type phy_type, char **ap_data, uint8_t *aps)
 		return -1;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_AP_SCAN;
 	d.cmd->data[0] = phy_type;
 	d.cmd->data_len = 1;
@@ -499,6 +612,7 @@ enum mw_err mw_ap_assoc(uint8_t slot)
 		return MW_ERR_NOT_READY;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_AP_JOIN;
 	d.cmd->data_len = 1;
 	d.cmd->data[0] = slot;
@@ -510,6 +624,35 @@ enum mw_err mw_ap_assoc(uint8_t slot)
 	return MW_ERR_NONE;
 }
 
+enum mw_err mw_ap_assoc_bssid(uint8_t slot, const uint8_t *bssid,
+		uint8_t channel, int *targeted)
+{
+	enum mw_err err;
+
+	if (!d.mw_ready) {
+		return MW_ERR_NOT_READY;
+	}
+	if (!bssid || !targeted) {
+		return MW_ERR_PARAM;
+	}
+
+	cmd_lock();
+	d.cmd->cmd = MW_CMD_AP_JOIN;
+	d.cmd->data_len = 2 + MW_BSSID_LEN;
+	d.cmd->data[0] = slot;
+	memcpy(&d.cmd->data[1], bssid, MW_BSSID_LEN);
+	d.cmd->data[1 + MW_BSSID_LEN] = channel;
+	err = mw_command(MW_ASSOC_TOUT);
+	if (err) {
+		return MW_ERR;
+	}
+	// Firmware with support echoes the BSSID and channel, other firmware
+	// ignores them and replies with no data
+	*targeted = (2 + MW_BSSID_LEN) == d.cmd->data_len;
+
+	return MW_ERR_NONE;
+}
+
 static void stat_reply_cb(enum lsd_status err, uint8_t ch, char *data,
 		uint16_t len, void *ctx)
 {
@@ -522,7 +665,7 @@ static void stat_reply_cb(enum lsd_status err, uint8_t ch, char *data,
 		// We are associated!
 		loop_timer_stop(&d.timer);
 		d.stat_poll = FALSE;
-		loop_post(1);
+		loop_wake(&d.wait, 1);
 	} else {
 		// Query the system status again
 		d.cmd->cmd = MW_CMD_SYS_STAT;
@@ -538,11 +681,11 @@ static void assoc_poll_timer_cb(struct loop_timer *t)
 		if (d.tout_frames <= 0) {
 			d.stat_poll = FALSE;
 			loop_timer_stop(t);
-			loop_post(-1);
+			loop_wake(&d.wait, -1);
 			return;
 		}
 	}
-	mw_cmd_recv(d.cmd, NULL, stat_reply_cb);
+	cmd_reply_recv(NULL, stat_reply_cb);
 }
 
 enum mw_err mw_ap_assoc_wait(int tout_frames)
@@ -550,6 +693,7 @@ enum mw_err mw_ap_assoc_wait(int tout_frames)
 	int ret;
 
 	// Send command and do not look back
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_SYS_STAT;
 	d.cmd->data_len = 0;
 	mw_cmd_send(d.cmd, NULL, NULL);
@@ -559,12 +703,15 @@ enum mw_err mw_ap_assoc_wait(int tout_frames)
 	d.stat_poll = TRUE;
 	d.timer.timer_cb = assoc_poll_timer_cb;
 	d.timer.auto_reload = TRUE;
+	d.timer.phase_mode = LOOP_PHASE_AUTO;
 	loop_timer_start(&d.timer, MW_STAT_POLL_TOUT);
-	ret = loop_pend();
+	ret = loop_wait(&d.wait);
 
 	// Restore default timer values
 	d.timer.timer_cb = cmd_tout_cb;
 	d.timer.auto_reload = FALSE;
+	d.timer.phase_mode = LOOP_PHASE_NONE;
+	cmd_unlock();
 
 	return ret < 0?MW_ERR_NOT_READY:MW_ERR_NONE;
 }
@@ -577,6 +724,7 @@ enum mw_err mw_ap_disassoc(void)
 		return MW_ERR_NOT_READY;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_AP_LEAVE;
 	d.cmd->data_len = 0;
 	err = mw_command(MW_COMMAND_TOUT);
@@ -596,6 +744,7 @@ enum mw_err mw_def_ap_cfg(uint8_t slot)
 	}
 
 	d.cmd->data_len = 1;
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_DEF_AP_CFG;
 	d.cmd->data[0] = slot;
 	err = mw_command(MW_COMMAND_TOUT);
@@ -611,6 +760,7 @@ int mw_def_ap_cfg_get(void)
 	enum mw_err err;
 
 	d.cmd->data_len = 0;
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_DEF_AP_CFG_GET;
 	err = mw_command(MW_COMMAND_TOUT);
 	if (err) {
@@ -652,6 +802,7 @@ enum mw_err mw_tcp_connect(uint8_t ch, const char *dst_addr,
 	}
 
 	// Configure TCP socket
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_TCP_CON;
 	d.cmd->data_len = fill_addr(dst_addr, dst_port, src_port,
 			&d.cmd->in_addr);
@@ -675,6 +826,7 @@ enum mw_err mw_close(uint8_t ch)
 		return MW_ERR_NOT_READY;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_CLOSE;
 	d.cmd->data_len = 1;
 	d.cmd->data[0] = ch;
@@ -697,6 +849,7 @@ enum mw_err mw_tcp_bind(uint8_t ch, uint16_t port)
 		return MW_ERR_NOT_READY;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_TCP_BIND;
 	d.cmd->data_len = 7;
 	d.cmd->bind.reserved = 0;
@@ -725,6 +878,7 @@ enum mw_err mw_udp_set(uint8_t ch, const char *dst_addr, const char *dst_port,
 	}
 
 	// Configure UDP socket
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_UDP_SET;
 	d.cmd->data_len = fill_addr(dst_addr, dst_port, src_port,
 			&d.cmd->in_addr);
@@ -752,7 +906,7 @@ static void sock_stat_reply_cb(enum lsd_status err, uint8_t ch, char *data,
 		// Ready to send/receive data
 		loop_timer_stop(&d.timer);
 		d.stat_poll = FALSE;
-		loop_post(1);
+		loop_wake(&d.wait, 1);
 	} else {
 		// Query the system status again
 		d.cmd->cmd = MW_CMD_SOCK_STAT;
@@ -769,11 +923,11 @@ static void sock_poll_timer_cb(struct loop_timer *t)
 		if (d.tout_frames <= 0) {
 			d.stat_poll = FALSE;
 			loop_timer_stop(t);
-			loop_post(-1);
+			loop_wake(&d.wait, -1);
 			return;
 		}
 	}
-	mw_cmd_recv(d.cmd, NULL, sock_stat_reply_cb);
+	cmd_reply_recv(NULL, sock_stat_reply_cb);
 }
 
 enum mw_err mw_sock_conn_wait(uint8_t ch, int tout_frames)
@@ -781,6 +935,7 @@ enum mw_err mw_sock_conn_wait(uint8_t ch, int tout_frames)
 	int ret;
 
 	// Send command and do not look back
+	cmd_lock();
 	d.monitor_ch = ch;
 	d.cmd->cmd = MW_CMD_SOCK_STAT;
 	d.cmd->data_len = 1;
@@ -792,12 +947,15 @@ enum mw_err mw_sock_conn_wait(uint8_t ch, int tout_frames)
 	d.stat_poll = TRUE;
 	d.timer.timer_cb = sock_poll_timer_cb;
 	d.timer.auto_reload = TRUE;
+	d.timer.phase_mode = LOOP_PHASE_AUTO;
 	loop_timer_start(&d.timer, MW_STAT_POLL_TOUT);
-	ret = loop_pend();
+	ret = loop_wait(&d.wait);
 
 	// Restore default timer values
 	d.timer.timer_cb = cmd_tout_cb;
 	d.timer.auto_reload = FALSE;
+	d.timer.phase_mode = LOOP_PHASE_NONE;
+	cmd_unlock();
 
 	return ret < 0?MW_ERR_NOT_READY:MW_ERR_NONE;
 }
@@ -810,6 +968,7 @@ union mw_msg_sys_stat *mw_sys_stat_get(void)
 		return NULL;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_SYS_STAT;
 	d.cmd->data_len = 0;
 	err = mw_command(MW_COMMAND_TOUT);
@@ -828,6 +987,7 @@ enum mw_sock_stat mw_sock_stat_get(uint8_t ch)
 		return -1;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_SOCK_STAT;
 	d.cmd->data_len = 1;
 	d.cmd->data[0] = ch;
@@ -850,6 +1010,7 @@ enum mw_err mw_sntp_cfg_set(const char *tz_str, const char *server[3])
 		return MW_ERR_NOT_READY;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_SNTP_CFG;
 	offset = 1 + strlen(tz_str);
 	memcpy(d.cmd->data, tz_str, offset);
@@ -896,6 +1057,7 @@ enum mw_err mw_sntp_cfg_get(char **tz_str, char *server[3])
 		return MW_ERR_NOT_READY;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_SNTP_CFG_GET;
 	d.cmd->data_len = 0;
 
@@ -921,6 +1083,7 @@ char *mw_date_time_get(uint32_t dt_bin[2])
 		return NULL;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_DATETIME;
 	d.cmd->data_len = 0;
 	err = mw_command(MW_COMMAND_TOUT);
@@ -946,6 +1109,7 @@ enum mw_err mw_flash_id_get(uint8_t *man_id, uint16_t *dev_id)
 		return MW_ERR_NOT_READY;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_FLASH_ID;
 	d.cmd->data_len = 0;
 	err = mw_command(MW_COMMAND_TOUT);
@@ -972,6 +1136,7 @@ enum mw_err mw_flash_sector_erase(uint16_t sect)
 		return MW_ERR_NOT_READY;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_FLASH_ERASE;
 	d.cmd->data_len = sizeof(uint16_t);
 	d.cmd->fl_sect = sect;
@@ -991,7 +1156,11 @@ enum mw_err mw_flash_write(uint32_t addr, uint8_t *data, uint16_t data_len)
 	if (!d.mw_ready) {
 		return MW_ERR_NOT_READY;
 	}
+	if ((data_len + sizeof(uint32_t)) > mw_cmd_data_max()) {
+		return MW_ERR_PARAM;
+	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_FLASH_WRITE;
 	d.cmd->data_len = data_len + sizeof(uint32_t);
 	d.cmd->fl_data.addr = addr;
@@ -1009,10 +1178,11 @@ uint8_t *mw_flash_read(uint32_t addr, uint16_t data_len)
 {
 	enum mw_err err;
 
-	if (!d.mw_ready || data_len > d.buf_len) {
+	if (!d.mw_ready || data_len > mw_cmd_data_max()) {
 		return NULL;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_FLASH_READ;
 	d.cmd->fl_range.addr = addr;
 	d.cmd->fl_range.len = data_len;
@@ -1025,6 +1195,97 @@ uint8_t *mw_flash_read(uint32_t addr, uint16_t data_len)
 	return d.cmd->data;
 }
 
+// Sends data straight from its location (RAM or ROM) with no intermediate
+// copies, using full length LSD frames. Stops on the first error.
+static enum mw_err stream_send(uint8_t ch, const char *data, uint32_t len)
+{
+	int16_t to_send;
+	uint32_t sent = 0;
+	enum mw_err err = MW_ERR_NONE;
+
+	lsd_ch_enable(ch);
+	while (!err && sent < len) {
+		to_send = MIN(len - sent, LSD_MAX_LEN);
+		if (LSD_STAT_BUSY != lsd_send(ch, data + sent, to_send,
+					NULL, cmd_send_cb)) {
+			err = MW_ERR_SEND;
+			break;
+		}
+		loop_timer_start(&d.timer, MW_COMMAND_TOUT);
+		if (CMD_OK != loop_wait(&d.wait)) {
+			err = MW_ERR_SEND;
+		} else {
+			sent += to_send;
+		}
+	}
+	lsd_ch_disable(ch);
+
+	return err;
+}
+
+// Writes using MW_CMD_FLASH_WRITE commands, as long as the frames allow
+static enum mw_err flash_write_chunked(uint32_t addr, const uint8_t *data,
+		uint32_t data_len)
+{
+	uint16_t chunk_max = mw_cmd_data_max() - sizeof(uint32_t);
+	uint16_t chunk;
+	enum mw_err err = MW_ERR_NONE;
+
+	while (!err && data_len) {
+		chunk = MIN(data_len, chunk_max);
+		err = mw_flash_write(addr, (uint8_t*)data, chunk);
+		addr += chunk;
+		data += chunk;
+		data_len -= chunk;
+	}
+
+	return err;
+}
+
+// Address 0 corresponds to flash address 0x80000
+enum mw_err mw_flash_write_stream(uint32_t addr, const uint8_t *data,
+		uint32_t data_len)
+{
+	enum mw_err err;
+
+	if (!d.mw_ready) {
+		return MW_ERR_NOT_READY;
+	}
+	if (!data || !data_len) {
+		return MW_ERR_PARAM;
+	}
+
+	if (!d.no_stream) {
+		// Lock is kept until the module acknowledges the whole stream
+		cmd_lock();
+		d.cmd->cmd = MW_CMD_FLASH_WRITE_STREAM;
+		d.cmd->data_len = sizeof(struct mw_msg_flash_stream);
+		d.cmd->fl_stream.addr = addr;
+		d.cmd->fl_stream.len = data_len;
+		err = cmd_run(MW_COMMAND_TOUT);
+		if (!err) {
+			// Command accepted, stream the payload
+			err = stream_send(MW_STREAM_CH, (const char*)data,
+					data_len);
+			if (!err) {
+				// Module replies when all the data is written
+				err = cmd_reply_wait(MW_COMMAND_TOUT);
+			}
+			cmd_unlock();
+			return err;
+		}
+		cmd_unlock();
+		if (MW_CMD_ERROR != d.cmd->cmd) {
+			return MW_ERR;
+		}
+		// Firmware without streaming support rejects the command,
+		// do not try again until the module is initialized
+		d.no_stream = TRUE;
+	}
+
+	return flash_write_chunked(addr, data, data_len);
+}
+
 uint8_t *mw_hrng_get(uint16_t rnd_len) {
 	enum mw_err err;
 
@@ -1032,6 +1293,7 @@ uint8_t *mw_hrng_get(uint16_t rnd_len) {
 		return NULL;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_HRNG_GET;
 	d.cmd->data_len = sizeof(uint16_t);
 	d.cmd->rnd_len = rnd_len;
@@ -1051,6 +1313,7 @@ uint8_t *mw_bssid_get(enum mw_if_type interface_type)
 		return NULL;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_BSSID_GET;
 	d.cmd->data_len = 1;
 	d.cmd->data[0] = interface_type;
@@ -1070,6 +1333,7 @@ enum mw_err mw_gamertag_set(uint8_t slot, const struct mw_gamertag *gamertag)
 		return MW_ERR_NOT_READY;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_GAMERTAG_SET;
 	d.cmd->gamertag_set.slot = slot;
 	d.cmd->gamertag_set.reserved[0] = 0;
@@ -1094,6 +1358,7 @@ struct mw_gamertag *mw_gamertag_get(uint8_t slot)
 		return NULL;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_GAMERTAG_GET;
 	d.cmd->data_len = 1;
 	d.cmd->data[0] = slot;
@@ -1118,6 +1383,7 @@ enum mw_err mw_http_url_set(const char *url)
 		return MW_ERR_PARAM;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_HTTP_URL_SET;
 	d.cmd->data_len = len + 1;
 	memcpy(d.cmd->data, url, len + 1);
@@ -1141,6 +1407,7 @@ enum mw_err mw_http_method_set(enum mw_http_method method)
 		return MW_ERR_PARAM;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_HTTP_METHOD_SET;
 	d.cmd->data_len = 1;
 	d.cmd->data[0] = method;
@@ -1170,6 +1437,7 @@ enum mw_err mw_http_header_add(const char *key, const char *value)
 
 	key_len++;
 	value_len++;
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_HTTP_HDR_ADD;
 	d.cmd->data_len = key_len + value_len;
 	memcpy(d.cmd->data, key, key_len);
@@ -1195,6 +1463,7 @@ enum mw_err mw_http_header_del(const char *key)
 		return MW_ERR_PARAM;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_HTTP_HDR_DEL;
 	d.cmd->data_len = len + 1;
 	memcpy(d.cmd->data, key, len + 1);
@@ -1214,6 +1483,7 @@ enum mw_err mw_http_open(uint32_t content_len)
 		return MW_ERR_NOT_READY;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_HTTP_OPEN;
 	d.cmd->data_len = 4;
 	d.cmd->dw_data[0] = content_len;
@@ -1238,6 +1508,7 @@ int mw_http_finish(uint32_t *content_len, int tout_frames)
 		return MW_ERR_PARAM;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_HTTP_FINISH;
 	d.cmd->data_len = 0;
 	err = mw_command(tout_frames);
@@ -1257,6 +1528,7 @@ uint32_t mw_http_cert_query(void)
 		return 0xFFFFFFFF;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_HTTP_CERT_QUERY;
 	d.cmd->data_len = 0;
 	err = mw_command(MW_COMMAND_TOUT);
@@ -1279,21 +1551,24 @@ enum mw_err mw_http_cert_set(uint32_t cert_hash, const char *cert,
 	if (cert_len && !cert) {
 		return MW_ERR_PARAM;
 	}
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_HTTP_CERT_SET;
 	d.cmd->data_len = 6;
 	d.cmd->dw_data[0] = cert_hash;
 	d.cmd->w_data[2] = cert_len;
-	err = mw_command(MW_COMMAND_TOUT);
+	err = cmd_run(MW_COMMAND_TOUT);
 	if (err) {
+		cmd_unlock();
 		return MW_ERR;
 	}
 
-	lsd_ch_enable(MW_HTTP_CH);
-	// Command succeeded, now send the certificate using MW_CH_HTTP
-	err = mw_send_sync(MW_HTTP_CH, cert, cert_len, 0);
-	lsd_ch_disable(MW_HTTP_CH);
+	// Command succeeded, now stream the certificate from its location
+	// using MW_HTTP_CH. Keep the lock, the stream uses the command timer
+	// and wait object
+	err = stream_send(MW_HTTP_CH, cert, cert_len);
+	cmd_unlock();
 
-	return MW_ERR_NONE;
+	return err;
 }
 
 int mw_http_cleanup(void)
@@ -1304,6 +1579,7 @@ int mw_http_cleanup(void)
 		return MW_ERR_NOT_READY;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_HTTP_FINISH;
 	d.cmd->data_len = 0;
 	err = mw_command(MW_COMMAND_TOUT);
@@ -1323,6 +1599,7 @@ char *mw_def_server_get(void)
 		return NULL;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_SERVER_URL_GET;
 	d.cmd->data_len = 0;
 	err = mw_command(MW_COMMAND_TOUT);
@@ -1346,6 +1623,7 @@ enum mw_err mw_def_server_set(const char *server_url)
 		return MW_ERR_PARAM;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_SERVER_URL_SET;
 	d.cmd->data_len = len + 1;
 	memcpy(d.cmd->data, server_url, len + 1);
@@ -1365,6 +1643,7 @@ enum mw_err mw_log(const char *msg)
 		return MW_ERR_NOT_READY;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_LOG;
 	d.cmd->data_len = strlen(msg) + 1;
 	memcpy(d.cmd->data, msg, d.cmd->data_len);
@@ -1385,6 +1664,7 @@ enum mw_err mw_factory_settings(void)
 		return MW_ERR_NOT_READY;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_FACTORY_RESET;
 	d.cmd->data_len = 0;
 
@@ -1398,16 +1678,20 @@ enum mw_err mw_factory_settings(void)
 
 void mw_power_off(void)
 {
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_SLEEP;
 	d.cmd->data_len = 0;
 
 	mw_cmd_send(d.cmd, NULL, NULL);
+	cmd_unlock();
 }
 
 void mw_sleep(uint16_t frames)
 {
+	cmd_lock();
 	loop_timer_start(&d.timer, frames);
-	loop_pend();
+	loop_wait(&d.wait);
+	cmd_unlock();
 }
 
 enum mw_err mw_cfg_save(void)
@@ -1418,6 +1702,7 @@ enum mw_err mw_cfg_save(void)
 		return MW_ERR_NOT_READY;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_NV_CFG_SAVE;
 	d.cmd->data_len = 0;
 
@@ -1437,6 +1722,7 @@ struct mw_wifi_adv_cfg *mw_wifi_adv_cfg_get(void)
 		return NULL;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_WIFI_ADV_GET;
 	d.cmd->data_len = 0;
 	err = mw_command(MW_COMMAND_TOUT);
@@ -1455,6 +1741,7 @@ enum mw_err mw_wifi_adv_cfg_set(const struct mw_wifi_adv_cfg *wifi)
 		return MW_ERR_NOT_READY;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_WIFI_ADV_SET;
 	d.cmd->data_len = sizeof(struct mw_wifi_adv_cfg);
 	d.cmd->wifi_adv_cfg = *wifi;
@@ -1474,6 +1761,7 @@ enum mw_err mw_fw_upgrade(const char *name)
 		return MW_ERR_NOT_READY;
 	}
 
+	cmd_lock();
 	d.cmd->cmd = MW_CMD_UPGRADE_PERFORM;
 	d.cmd->data_len = strlen(name) + 1;
 	memcpy(d.cmd->data, name, d.cmd->data_len);
@@ -1485,3 +1773,121 @@ enum mw_err mw_fw_upgrade(const char *name)
 	return MW_ERR_NONE;
 }
 
+static void upgrade_end(enum mw_upgrade_stat stat)
+{
+	loop_timer_stop(&d.timer);
+	// Restore default timer values
+	d.timer.timer_cb = cmd_tout_cb;
+	d.timer.auto_reload = FALSE;
+	d.timer.phase_mode = LOOP_PHASE_NONE;
+	d.upgrading = FALSE;
+	cmd_unlock();
+	d.upgrade_cb(stat, d.upg_done, d.upg_total, d.elapsed);
+}
+
+static void upgrade_reply_cb(enum lsd_status err, uint8_t ch, char *data,
+		uint16_t len, void *ctx)
+{
+	UNUSED_PARAM(ctx);
+
+	if (!d.upgrading) {
+		// Upgrade aborted
+		return;
+	}
+	if (err) {
+		upgrade_end(MW_UPGRADE_ERROR);
+		return;
+	}
+	if (MW_CTRL_CH != ch) {
+		// We might receive network data while upgrading
+		if (d.cmd_data_cb) {
+			d.cmd_data_cb(LSD_STAT_COMPLETE, ch, data, len, NULL);
+		}
+		cmd_reply_recv(NULL, upgrade_reply_cb);
+		return;
+	}
+
+	switch (d.cmd->cmd) {
+	case MW_CMD_UPGRADE_PROGRESS:
+		d.upg_done = d.cmd->upg_progress.done;
+		d.upg_total = d.cmd->upg_progress.total;
+		cmd_reply_recv(NULL, upgrade_reply_cb);
+		d.upgrade_cb(MW_UPGRADE_IN_PROGRESS, d.upg_done, d.upg_total,
+				d.elapsed);
+		break;
+
+	case MW_CMD_OK:
+		d.upg_done = d.upg_total;
+		upgrade_end(MW_UPGRADE_DONE);
+		break;
+
+	default:
+		upgrade_end(MW_UPGRADE_ERROR);
+		break;
+	}
+}
+
+static void upgrade_timer_cb(struct loop_timer *t)
+{
+	UNUSED_PARAM(t);
+
+	d.elapsed += MW_STAT_POLL_TOUT;
+	d.tout_frames -= MW_STAT_POLL_TOUT;
+	if (d.tout_frames <= 0) {
+		// Module state is unknown, keep it in reset
+		mw_module_reset();
+		upgrade_end(MW_UPGRADE_TIMEOUT);
+	} else {
+		d.upgrade_cb(MW_UPGRADE_IN_PROGRESS, d.upg_done, d.upg_total,
+				d.elapsed);
+	}
+}
+
+enum mw_err mw_fw_upgrade_start(const char *name, int16_t tout_frames,
+		mw_upgrade_cb upgrade_cb)
+{
+	if (!d.mw_ready || d.upgrading) {
+		return MW_ERR_NOT_READY;
+	}
+	if (!name || !upgrade_cb || tout_frames <= 0) {
+		return MW_ERR_PARAM;
+	}
+
+	cmd_lock();
+	d.cmd->cmd = MW_CMD_UPGRADE_PERFORM;
+	d.cmd->data_len = strlen(name) + 1;
+	memcpy(d.cmd->data, name, d.cmd->data_len);
+	// Send command and do not look back
+	mw_cmd_send(d.cmd, NULL, NULL);
+	cmd_reply_recv(NULL, upgrade_reply_cb);
+
+	d.upgrade_cb = upgrade_cb;
+	d.upg_done = d.upg_total = 0;
+	d.elapsed = 0;
+	d.tout_frames = tout_frames;
+	d.upgrading = TRUE;
+	// Carefully reuse the command timer
+	d.timer.timer_cb = upgrade_timer_cb;
+	d.timer.auto_reload = TRUE;
+	d.timer.phase_mode = LOOP_PHASE_AUTO;
+	loop_timer_start(&d.timer, MW_STAT_POLL_TOUT);
+
+	return MW_ERR_NONE;
+}
+
+void mw_fw_upgrade_abort(void)
+{
+	if (!d.upgrading) {
+		return;
+	}
+
+	loop_timer_stop(&d.timer);
+	d.timer.timer_cb = cmd_tout_cb;
+	d.timer.auto_reload = FALSE;
+	d.timer.phase_mode = LOOP_PHASE_NONE;
+	d.upgrading = FALSE;
+	cmd_unlock();
+	// Module state is unknown, keep it in reset
+	mw_module_reset();
+}
+
@@ -20,6 +20,14 @@
  * \date 2015
  *
  * \note This module uses a loop_timer from the loop module.
+ * \note Several tasks can use the API. Commands are serialized by a lock,
+ * held from filling the command buffer until the reply arrives. Data
+ * returned by pointer lives in the command buffer, so copy it before
+ * waiting on anything.
+ * \note Nested (not in task) waits return in reverse order. A callback not
+ * running in a task must not issue commands while another callback not in a
+ * task is waiting on one: the lock could not be released until the later
+ * wait returns.
  *
  * \todo Missing a lot of integrity checks, also module should track used
  *       channels, and is not currently doing it
@@ -99,11 +107,18 @@ enum mw_http_method {
 /// Channel used for HTTP requests and cert sets
 #define MW_HTTP_CH			LSD_MAX_CH - 1
 
+/// Channel used to stream bulk payloads. Shared with HTTP, so streaming
+/// cannot be used while an HTTP request is in progress.
+#define MW_STREAM_CH			MW_HTTP_CH
+
 /// Minimum command buffer length to be able to send all available commands
 /// with minimum data payload. This length might not guarantee that commands
 /// like mw_sntp_cfg_set() can be sent if payload length is big enough).
 #define MW_CMD_MIN_BUFLEN	168
 
+/// Length of a BSSID in bytes
+#define MW_BSSID_LEN		6
+
 /// Access Point data.
 struct mw_ap_data {
 	enum mw_security auth;	///< Security type
@@ -113,6 +128,25 @@ struct mw_ap_data {
 	char *ssid;		///< SSID string (not NULL terminated).
 };
 
+/// Status reported by mw_fw_upgrade_start() callback.
+enum mw_upgrade_stat {
+	MW_UPGRADE_IN_PROGRESS = 0,	///< Upgrade in progress
+	MW_UPGRADE_DONE,		///< Upgrade successfully completed
+	MW_UPGRADE_ERROR,		///< Upgrade failed
+	MW_UPGRADE_TIMEOUT		///< Upgrade timed out and was aborted
+};
+
+/************************************************************************//**
+ * \brief Firmware upgrade progress callback.
+ *
+ * \param[in] stat   Upgrade status.
+ * \param[in] done   Downloaded bytes.
+ * \param[in] total  Firmware length, 0 if unknown.
+ * \param[in] frames Frames elapsed since upgrade started.
+ ****************************************************************************/
+typedef void (*mw_upgrade_cb)(enum mw_upgrade_stat stat, uint32_t done,
+		uint32_t total, uint16_t frames);
+
 /// Interface type for the mw_bssid_get() function.
 enum mw_if_type {
 	MW_IF_STATION = 0,	///< Station interface
@@ -125,12 +159,33 @@ enum mw_if_type {
  *        other function. It also initializes de UART.
  *
  * \param[in] cmd_buf Pointer to the buffer used to send and receive commands.
+ *                    If NULL, buffer is allocated from the memory pool.
  * \param[in] buf_len Length of cmdBuf in bytes. 
  *
  * \return MW_ERR_NONE on success, other code on failure.
  ****************************************************************************/
 int mw_init(char *cmd_buf, uint16_t buf_len);
 
+/************************************************************************//**
+ * \brief Negotiates with the module the maximum command frame length. Until
+ * this function is called, MW_MSG_MAX_BUFLEN is used.
+ *
+ * \param[in] frame_len Requested frame length. It is limited to the command
+ *            buffer length and to LSD_MAX_LEN.
+ *
+ * \return The frame length in use after the negotiation. Firmware not
+ * supporting negotiation keeps MW_MSG_MAX_BUFLEN.
+ ****************************************************************************/
+uint16_t mw_frame_len_set(uint16_t frame_len);
+
+/************************************************************************//**
+ * \brief Get the maximum payload length of a command, using the negotiated
+ * frame length.
+ *
+ * \return Maximum command payload length in bytes.
+ ****************************************************************************/
+uint16_t mw_cmd_data_max(void);
+
 /************************************************************************//**
  * \brief Processes sends/receives pending data.
  *
@@ -141,6 +196,13 @@ int mw_init(char *cmd_buf, uint16_t buf_len);
  ****************************************************************************/
 static inline void mw_process(void)	{lsd_process();}
 
+/************************************************************************//**
+ * \brief Check if there is data pending to be sent or received.
+ *
+ * \return TRUE if mw_process() has work to do, FALSE otherwise.
+ ****************************************************************************/
+static inline int mw_busy(void)		{return lsd_busy();}
+
 /************************************************************************//**
  * \brief Sets the callback function to be run when network data is received
  * while waiting for a command reply.
@@ -334,6 +396,27 @@ int mw_ap_fill_next(const char *ap_data, uint16_t pos,
  ****************************************************************************/
 enum mw_err mw_ap_assoc(uint8_t slot);
 
+/************************************************************************//**
+ * \brief Tries associating to an AP, targeting a known BSSID and channel.
+ * This avoids the full scan performed by mw_ap_assoc(). If the AP is not
+ * found, association will fail, and mw_ap_assoc() should be used.
+ *
+ * \param[in] slot    Configuration slot to use.
+ * \param[in] bssid   BSSID of the AP to associate to.
+ * \param[in] channel WiFi channel of the AP, or 0 if unknown.
+ * \param[out] targeted TRUE if the firmware started a targeted
+ *             association, FALSE if it started a standard one.
+ *
+ * \return MW_ERR_NONE if AP join operation has been successfully started,
+ * other code on failure.
+ *
+ * \note Firmware not supporting targeted association ignores bssid and
+ * channel, and performs a standard association. Then there is no need to
+ * retry with mw_ap_assoc() if it fails.
+ ****************************************************************************/
+enum mw_err mw_ap_assoc_bssid(uint8_t slot, const uint8_t *bssid,
+		uint8_t channel, int *targeted);
+
 /************************************************************************//**
  * \brief Polls the module status until it reports device is associated to
  * AP or timeout occurs.
@@ -637,11 +720,31 @@ enum mw_err mw_flash_sector_erase(uint16_t sect);
  ****************************************************************************/
 enum mw_err mw_flash_write(uint32_t addr, uint8_t *data, uint16_t data_len);
 
+/************************************************************************//**
+ * \brief Write a bulk payload to specified flash address. After the command
+ * is accepted, data is streamed on MW_STREAM_CH using full length LSD frames,
+ * and the function returns when the module acknowledges all data is written.
+ *
+ * \param[in] addr     Address to which data will be written.
+ * \param[in] data     Data to be written to flash chip.
+ * \param[in] data_len Length in bytes of data field.
+ *
+ * \return MW_ERR_NONE on success, other code on failure.
+ *
+ * \note Erase the destination sectors before streaming data.
+ * \note Firmware without MW_CMD_FLASH_WRITE_STREAM support rejects the
+ * command. Then data is written with mw_flash_write() commands, as long as
+ * allowed by mw_cmd_data_max(), and the stream command is not tried again.
+ ****************************************************************************/
+enum mw_err mw_flash_write_stream(uint32_t addr, const uint8_t *data,
+		uint32_t data_len);
+
 /************************************************************************//**
  * \brief Read data from specified flash address.
  *
  * \param[in] addr     Address from which data will be read.
- * \param[in] data_len Number of bytes to read from addr.
+ * \param[in] data_len Number of bytes to read from addr. Must not exceed
+ *                     mw_cmd_data_max().
  *
  * \return Pointer to read data on success, or NULL if command failed.
  ****************************************************************************/
@@ -806,6 +909,9 @@ uint32_t mw_http_cert_query(void);
  *                      previously stored certificate.
  *
  * \return MW_ERR_NONE on success, other code on failure.
+ *
+ * \note The certificate is sent directly from cert (that can point to ROM)
+ * using LSD_MAX_LEN chunks, it is not copied to the command buffer.
  ****************************************************************************/
 enum mw_err mw_http_cert_set(uint32_t cert_hash, const char *cert,
 		uint16_t cert_len);
@@ -856,6 +962,33 @@ uint8_t *mw_hrng_get(uint16_t rnd_len);
  ****************************************************************************/
 enum mw_err mw_fw_upgrade(const char *name);
 
+/************************************************************************//**
+ * \brief Starts an Over-The-Air upgrade of the WiFi module firmware, without
+ * blocking.
+ *
+ * The callback is run each time the module reports progress, every
+ * MW_STAT_POLL_MS, and once the upgrade ends. Progress is only reported by
+ * firmware supporting MW_CMD_UPGRADE_PROGRESS. With other firmware, done
+ * and total stay 0 until the upgrade ends. While the upgrade is in
+ * progress, other module commands wait until it ends. If the upgrade
+ * times out, the module is reset, and mw_detect() must be called before
+ * using it again.
+ *
+ * \param[in] name        Name of the firmware blob to upgrade.
+ * \param[in] tout_frames Maximum number of frames the upgrade can take.
+ * \param[in] upgrade_cb  Callback reporting upgrade progress.
+ *
+ * \return MW_ERR_NONE if the upgrade was started, other code on failure.
+ ****************************************************************************/
+enum mw_err mw_fw_upgrade_start(const char *name, int16_t tout_frames,
+		mw_upgrade_cb upgrade_cb);
+
+/************************************************************************//**
+ * \brief Aborts an upgrade started with mw_fw_upgrade_start(). The module is
+ * reset, and mw_detect() must be called before using it again.
+ ****************************************************************************/
+void mw_fw_upgrade_abort(void);
+
 /****** THE FOLLOWING COMMANDS ARE LOWER LEVEL AND USUALLY NOT NEEDED ******/
 
 /************************************************************************//**
@@ -105,6 +105,9 @@ enum PACKED mw_command {
 	MW_CMD_NV_CFG_SAVE	=  53,	///< Save non-volatile config
 	MW_CMD_UPGRADE_LIST	=  54,	///< Get firmware upgrade versions
 	MW_CMD_UPGRADE_PERFORM	=  55,	///< Start firmware upgrade
+	MW_CMD_UPGRADE_PROGRESS	=  56,	///< Firmware upgrade progress report
+	MW_CMD_FRAME_LEN_SET	=  57,	///< Negotiate maximum frame length
+	MW_CMD_FLASH_WRITE_STREAM =  58,///< Stream data to WiFi module flash
 	MW_CMD_ERROR		= 255	///< Error command reply
 };
 
@@ -197,6 +200,18 @@ struct mw_msg_flash_range {
 	uint16_t len;		///< Length of the block
 };
 
+/// Firmware upgrade progress report, not sent by all firmware versions
+struct mw_msg_upgrade_progress {
+	uint32_t done;		///< Downloaded bytes
+	uint32_t total;		///< Firmware length, 0 if unknown
+};
+
+/// Flash memory stream header. Data follows on MW_STREAM_CH
+struct mw_msg_flash_stream {
+	uint32_t addr;		///< Start address
+	uint32_t len;		///< Length of the data to stream
+};
+
 /// Bind message data
 struct mw_msg_bind {
 	uint32_t reserved;	///< Reserved, set to 0
@@ -327,7 +342,12 @@ typedef union mw_cmd {
 			struct mw_gamertag gamertag_get;	///< Gamertag get
 			struct mw_wifi_adv_cfg wifi_adv_cfg;	///< Advanced WiFi configuration
 			struct mw_flash_id flash_id;		///< Flash chip identifiers
+			/// Firmware upgrade progress
+			struct mw_msg_upgrade_progress upg_progress;
+			/// Flash memory stream header
+			struct mw_msg_flash_stream fl_stream;
 			uint16_t fl_sect;	///< Flash sector
+			uint16_t frame_len;	///< Maximum frame length
 			uint32_t fl_id;		///< Flash IDs
 			uint16_t rnd_len;	///< Length of the random buffer to fill
 		};
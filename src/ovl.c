@@ -0,0 +1,47 @@
+#include <string.h>
+#include "ovl.h"
+
+/// Overlay load addresses, defined by the linker script
+extern const uint8_t __load_start_ovl_flash[], __load_stop_ovl_flash[];
+extern const uint8_t __load_start_ovl_stage[], __load_stop_ovl_stage[];
+/// RAM window where overlays run
+extern uint8_t _ovl_window[];
+
+struct ovl_def {
+	const uint8_t *start;
+	const uint8_t *stop;
+};
+
+static const struct ovl_def ovl[OVL_MAX] = {
+	[OVL_FLASH] = {__load_start_ovl_flash, __load_stop_ovl_flash},
+	[OVL_STAGE] = {__load_start_ovl_stage, __load_stop_ovl_stage}
+};
+
+static enum ovl_id loaded = OVL_NONE;
+static uint8_t pinned = 0;
+
+int ovl_load(enum ovl_id id)
+{
+	if (loaded == id) {
+		return 0;
+	}
+	if (pinned) {
+		return 1;
+	}
+
+	memcpy(_ovl_window, ovl[id].start, ovl[id].stop - ovl[id].start);
+	loaded = id;
+
+	return 0;
+}
+
+void ovl_pin(int pin)
+{
+	pinned = pin;
+}
+
+enum ovl_id ovl_loaded(void)
+{
+	return loaded;
+}
+
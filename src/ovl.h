@@ -0,0 +1,79 @@
+/************************************************************************//**
+ * \file
+ *
+ * \brief RAM code overlays.
+ *
+ * \defgroup ovl ovl
+ * \{
+ *
+ * \brief RAM code overlays.
+ *
+ * Code that has to run from RAM only while the flash chip is busy, is
+ * grouped in overlays. Overlays are stored in ROM, and share a RAM window
+ * placed after the .bss section (see split.ld). ovl_load() copies an
+ * overlay to the window when it is not already there, so the RAM used by
+ * these routines is bounded by the largest overlay.
+ *
+ * Overlay contents are selected by section name:
+ * - OVL_FLASH: flash chip routines and the programming engine, in
+ *   .flash.* sections (FS_T() and FS_RO() macros from flash.h).
+ * - OVL_STAGE: image staging to the module flash, in .stage.* sections.
+ *
+ * Code in an overlay can call resident code, but not code in other
+ * overlays. Resident code must load the overlay before calling its
+ * functions, and must not call them if the load fails. OVL_CALL() does it
+ * for a single call.
+ *
+ * \warning Do not load an overlay while code from the loaded one is in the
+ * call stack, e.g. from a callback invoked by overlay code. The loaded
+ * overlay can be pinned (ovl_pin()), so other overlays fail to load while
+ * its code must stay in RAM.
+ ****************************************************************************/
+
+#ifndef _OVL_H_
+#define _OVL_H_
+
+#include <stdint.h>
+
+/// Overlay identifiers
+enum ovl_id {
+	OVL_NONE = 0,	///< No overlay loaded
+	OVL_FLASH,	///< Flash chip routines and programming engine
+	OVL_STAGE,	///< Image staging to module flash
+	OVL_MAX		///< Number of overlay identifiers
+};
+
+/// Call a function placed in an overlay, loading the overlay if needed.
+/// If the overlay cannot be loaded, func is not called and the expression
+/// evaluates to fail instead.
+#define OVL_CALL(id, fail, func, ...)	\
+	(ovl_load(id) ? (fail) : func(__VA_ARGS__))
+
+/************************************************************************//**
+ * \brief Load an overlay to the RAM window, if not already loaded.
+ *
+ * \param[in] id Overlay to load.
+ *
+ * \return 0 if the overlay is loaded, 1 if another overlay is pinned.
+ ****************************************************************************/
+int ovl_load(enum ovl_id id);
+
+/************************************************************************//**
+ * \brief Pin or unpin the loaded overlay. While pinned, loading other
+ * overlays fails.
+ *
+ * \param[in] pin TRUE to pin the overlay, FALSE to unpin it.
+ ****************************************************************************/
+void ovl_pin(int pin);
+
+/************************************************************************//**
+ * \brief Get the overlay loaded in the RAM window.
+ *
+ * \return Loaded overlay, OVL_NONE if no overlay has been loaded.
+ ****************************************************************************/
+enum ovl_id ovl_loaded(void);
+
+#endif /*_OVL_H_*/
+
+/** \} */
+
@@ -0,0 +1,132 @@
+#include "prof.h"
+
+#ifdef LOOP_PROFILE
+
+#include "loop.h"
+#include "vdp.h"
+#include "util.h"
+#include "gamepad.h"
+
+/// First screen row used by the overlay
+#define PROF_ROW0		(VDP_SCREEN_VTILES - PROF_ROWS)
+
+/// Window plane address of an overlay row, for VdpDraw*() calls using y = 0
+#define ROW_ADDR(row)	(VDP_WIN_ADDR + 2 * VDP_WIN_HTILES * (PROF_ROW0 + (row)))
+
+/// Rows used by the header
+#define PROF_HEAD_ROWS		2
+
+/// Overlay refresh period
+#define PROF_REFRESH_FRAMES	MS_TO_FRAMES(500)
+
+/// Line length
+#define PROF_LINE_LEN		40
+
+static void refresh_cb(struct loop_timer *t);
+
+static struct loop_timer refresh_timer = {
+	.timer_cb = refresh_cb,
+	.auto_reload = TRUE,
+	.phase_mode = LOOP_PHASE_AUTO
+};
+
+static uint8_t visible;
+
+static void draw_cycles(uint8_t row, uint8_t x, uint32_t cycles)
+{
+	cycles = MIN(cycles, 0xFFFFFF);
+
+	VdpDrawHex(ROW_ADDR(row), x, 0, VDP_TXT_COL_WHITE, cycles>>16);
+	VdpDrawHex(ROW_ADDR(row), x + 2, 0, VDP_TXT_COL_WHITE, cycles>>8);
+	VdpDrawHex(ROW_ADDR(row), x + 4, 0, VDP_TXT_COL_WHITE, cycles);
+}
+
+// Line format: T CALLBACK MIN    AVG    MAX    OVR
+static void entry_draw(uint32_t cb, int timer, const struct loop_prof *prof,
+		void *ctx)
+{
+	uint8_t *row = ctx;
+
+	if (*row >= PROF_ROWS) {
+		return;
+	}
+
+	VdpDrawText(ROW_ADDR(*row), 0, 0, VDP_TXT_COL_CYAN, 2,
+			timer ? "T" : "F", ' ');
+	VdpDrawU32(ROW_ADDR(*row), 2, 0, VDP_TXT_COL_CYAN, cb);
+	draw_cycles(*row, 11, prof->min);
+	draw_cycles(*row, 18, prof->avg);
+	draw_cycles(*row, 25, prof->max);
+	VdpDrawHex(ROW_ADDR(*row), 32, 0, VDP_TXT_COL_MAGENTA,
+			prof->overruns>>8);
+	VdpDrawHex(ROW_ADDR(*row), 34, 0, VDP_TXT_COL_MAGENTA,
+			prof->overruns);
+	(*row)++;
+}
+
+static void overlay_draw(void)
+{
+	uint16_t dropped = loop_dropped_frames();
+	uint8_t row = PROF_HEAD_ROWS;
+
+	VdpDrawText(ROW_ADDR(0), 0, 0, VDP_TXT_COL_MAGENTA, PROF_LINE_LEN,
+			"LOOP PROFILE, DROPPED FRAMES:", ' ');
+	VdpDrawHex(ROW_ADDR(0), 30, 0, VDP_TXT_COL_MAGENTA, dropped>>8);
+	VdpDrawHex(ROW_ADDR(0), 32, 0, VDP_TXT_COL_MAGENTA, dropped);
+	VdpDrawText(ROW_ADDR(1), 0, 0, VDP_TXT_COL_WHITE, PROF_LINE_LEN,
+			"T CALLBACK MIN    AVG    MAX    OVR", ' ');
+
+	loop_prof_foreach(entry_draw, &row);
+	for (; row < PROF_ROWS; row++) {
+		VdpDrawText(ROW_ADDR(row), 0, 0, VDP_TXT_COL_WHITE,
+				PROF_LINE_LEN, "", ' ');
+	}
+}
+
+static void refresh_cb(struct loop_timer *t)
+{
+	UNUSED_PARAM(t);
+
+	overlay_draw();
+}
+
+static void overlay_toggle(void)
+{
+	visible = !visible;
+	if (visible) {
+		overlay_draw();
+		VdpWinBottomSet(PROF_ROWS);
+		loop_timer_start(&refresh_timer, PROF_REFRESH_FRAMES);
+	} else {
+		loop_timer_stop(&refresh_timer);
+		VdpWinBottomSet(0);
+	}
+}
+
+void prof_init(void)
+{
+	visible = FALSE;
+	loop_timer_add(&refresh_timer);
+}
+
+uint8_t prof_pad_filter(uint8_t pad_ev)
+{
+	// gp_read() returns 0 for pressed buttons
+	if (gp_read() & GP_START_MASK) {
+		return pad_ev;
+	}
+
+	if (pad_ev & GP_A_MASK) {
+		overlay_toggle();
+	} else if (pad_ev & GP_B_MASK) {
+		loop_prof_reset();
+		if (visible) {
+			overlay_draw();
+		}
+	}
+
+	// Button presses while START is held are not passed to the menu
+	return pad_ev & GP_START_MASK;
+}
+
+#endif /*LOOP_PROFILE*/
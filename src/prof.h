@@ -0,0 +1,41 @@
+/************************************************************************//**
+ * \file
+ *
+ * \brief Loop profiling overlay.
+ *
+ * \defgroup prof prof
+ * \{
+ *
+ * \brief Loop profiling overlay.
+ *
+ * Draws the loop callback profiling data on the bottom rows of the screen,
+ * using the window plane. While START is held, A toggles the overlay and
+ * B resets the profiling data. Only available when LOOP_PROFILE is defined.
+ ****************************************************************************/
+
+#ifndef _PROF_H_
+#define _PROF_H_
+
+#include <stdint.h>
+
+/// Number of screen rows used by the overlay
+#define PROF_ROWS	8
+
+/************************************************************************//**
+ * \brief Module initialization. Call after loop_init().
+ ****************************************************************************/
+void prof_init(void);
+
+/************************************************************************//**
+ * \brief Check pad events for the overlay combos.
+ *
+ * \param[in] pad_ev Pad press events (1 for pressed buttons).
+ *
+ * \return Pad events to pass to the menu (events consumed by the combos
+ * are removed).
+ ****************************************************************************/
+uint8_t prof_pad_filter(uint8_t pad_ev);
+
+#endif /*_PROF_H_*/
+
+/** \} */
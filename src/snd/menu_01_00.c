@@ -435,3 +435,6 @@ const uint8_t menu_01_00_data[6918]={
 	0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
 	0x80,0x80,0x80,0x80,0x9f,0xc0
 };
+
+/// Length of menu_01_00_data, so users do not depend on the array size
+const uint16_t menu_01_00_len = sizeof(menu_01_00_data);
@@ -20,3 +20,6 @@ const uint8_t sfx_data[276] ROM_DATA(sfx_data) = {
 	0x80,0xd5,0x80,0xc9,0x80,0xd5,0x01,0xc4,0xe2,0x80,0xd5,0x43,0x80,0xe2,0x80,0xd5,
 	0x01,0xfc,0x00,0x00
 };
+
+/// Length of sfx_data, so users do not depend on the array size
+const uint16_t sfx_len = sizeof(sfx_data);
@@ -1,51 +1,120 @@
 #include "sound.h"
-#include "../loop.h"
+#include "z80drv.h"
+#include "../z80.h"
 #include "../util.h"
 #include "../vdp.h"
 
-static int rate_60hz;
-static int frame_count;
+/// PSG data port
+#define PSG_PORT	(*((volatile uint8_t*)0xC00011))
 
-void psgfx_frame(void);
-void tfc_frame(void);
+/// Offset of the channel start offsets in the TFC header
+#define TFC_CH_OFF	10
+/// Number of TFC song channels
+#define TFC_CHANNELS	6
 
-ROM_TEXT(player_cb)
-static void player_cb(struct loop_timer *t)
+static int running;
+
+/// Song and effects data, kept to restart sound after the Z80 is used
+static struct {
+	const uint8_t *tfc_data;
+	const uint8_t *psg_data;
+	uint16_t tfc_len;
+	uint16_t psg_len;
+} loaded;
+
+ROM_TEXT(mbox_put16)
+static void mbox_put16(uint16_t addr, uint16_t val)
+{
+	Z80_RAM[addr] = val;
+	Z80_RAM[addr + 1] = val>>8;
+}
+
+// The TFC header (signature, channel offsets, title and author) is not
+// needed by the driver, data is copied from the first channel.
+ROM_TEXT(tfc_skip_get)
+static uint16_t tfc_skip_get(const uint8_t *tfc_data)
 {
-	UNUSED_PARAM(t);
+	const uint8_t *ch = tfc_data + TFC_CH_OFF;
+	uint16_t skip = 0xFFFF;
+	int i;
 
-	// If running at 60 Hz, skip one in six updates
-	if (!rate_60hz || (rate_60hz && (frame_count % 6))) {
-		tfc_frame();
-		psgfx_frame();
+	for (i = 0; i < TFC_CHANNELS; i++, ch += 2) {
+		skip = MIN(skip, ch[0] | (ch[1]<<8));
 	}
-	frame_count++;
-}
 
-static struct loop_timer player_timer = {
-	.timer_cb = player_cb,
-	.frames = 1,
-	.auto_reload = TRUE
-};
+	// Driver takes a base address below 0x100 as no song loaded
+	return MIN(skip, z80drv_len - 0x100);
+}
 
 ROM_TEXT(sound_init)
-uint16_t sound_init(const uint8_t *tfc_data, const uint8_t *psg_data)
+uint16_t sound_init(const uint8_t *tfc_data, uint16_t tfc_len,
+		const uint8_t *psg_data, uint16_t psg_len)
 {
-	uint16_t rc;
+	uint16_t skip = tfc_skip_get(tfc_data);
+	uint16_t tfc_addr = z80drv_len;
+	uint16_t psg_addr = tfc_addr + tfc_len - skip;
+	int i;
 
-	rate_60hz = VdpIs60Hz();
-	loop_timer_add(&player_timer);
-	rc = psgfx_init(psg_data);
-	tfc_init(tfc_data);
-	tfc_play(TRUE);
+	if ((psg_addr + psg_len) > (Z80_RAM_LEN - Z80DRV_STACK_LEN)) {
+		return 0;
+	}
+	loaded.tfc_data = tfc_data;
+	loaded.tfc_len = tfc_len;
+	loaded.psg_data = psg_data;
+	loaded.psg_len = psg_len;
 
-	return rc;
+	z80_load(0, z80drv, z80drv_len);
+	z80_load(tfc_addr, tfc_data + skip, tfc_len - skip);
+	z80_load(psg_addr, psg_data, psg_len);
+	mbox_put16(Z80DRV_MB_TFC, tfc_addr - skip);
+	mbox_put16(Z80DRV_MB_PSG, psg_addr);
+	Z80_RAM[Z80DRV_MB_RATE] = VdpIs60Hz();
+	for (i = 0; i < 2 * TFC_CHANNELS; i++) {
+		Z80_RAM[Z80DRV_MB_TFC_CH + i] = tfc_data[TFC_CH_OFF + i];
+	}
+	z80_start();
+	running = TRUE;
+
+	return (psg_data[0]<<8) | psg_data[1];
 }
 
 ROM_TEXT(sound_deinit)
 void sound_deinit(void)
 {
-	tfc_play(FALSE);
-	psgfx_deinit();
-	loop_timer_del(&player_timer);
+	running = FALSE;
+	// Also resets the YM2612, but the PSG must be muted
+	z80_stop();
+	PSG_PORT = 0x9F;
+	PSG_PORT = 0xBF;
+	PSG_PORT = 0xDF;
+	PSG_PORT = 0xFF;
+}
+
+ROM_TEXT(sound_restart)
+void sound_restart(void)
+{
+	if (!running && loaded.tfc_data) {
+		sound_init(loaded.tfc_data, loaded.tfc_len, loaded.psg_data,
+				loaded.psg_len);
+	}
+}
+
+ROM_TEXT(psgfx_play)
+void psgfx_play(uint16_t num)
+{
+	uint8_t wr, next;
+
+	if (!running) {
+		return;
+	}
+
+	z80_bus_req();
+	wr = Z80_RAM[Z80DRV_MB_SFX_WR];
+	next = (wr + 1) & (Z80DRV_SFX_Q_LEN - 1);
+	// Effect is dropped if the queue is full
+	if (next != Z80_RAM[Z80DRV_MB_SFX_RD]) {
+		Z80_RAM[Z80DRV_MB_SFX_Q + wr] = num;
+		Z80_RAM[Z80DRV_MB_SFX_WR] = next;
+	}
+	z80_bus_rel();
 }
@@ -15,23 +15,24 @@ enum menu_sfx {
 	SFX_MENU_TOGGLE   = 6	///< Menu toggle
 };
 
-/// Module initialization
-uint16_t sound_init(const uint8_t *tfc_data, const uint8_t *psg_data);
-/// Module deinitialization
+/// Module initialization: loads the song and effects to the Z80 driver and
+/// starts playing. Returns the number of effects, 0 if data does not fit.
+uint16_t sound_init(const uint8_t *tfc_data, uint16_t tfc_len,
+		const uint8_t *psg_data, uint16_t psg_len);
+/// Module deinitialization, stops the Z80 driver
 void sound_deinit(void);
+/// Load the driver again and restart the song, after sound_deinit() was
+/// called to use the Z80 for other tasks
+void sound_restart(void);
 
-// PSG player functions
-uint16_t psgfx_init(const uint8_t *data);
-void psgfx_deinit(void);
+/// Play a sound effect, posted to the Z80 driver
 void psgfx_play(uint16_t num);
 
-// TFC player functions
-void tfc_init(const uint8_t *data);
-void tfc_play(uint16_t play);
-
 extern const uint8_t menu_01_00_data[];
+extern const uint16_t menu_01_00_len;
 extern const uint8_t ojete_data[];
 extern const uint8_t sfx_data[];
+extern const uint16_t sfx_len;
 extern const uint8_t uwpsgfx_data[];
 
 #endif /*_SOUND_H_*/
@@ -0,0 +1,497 @@
+; Z80 sound driver for the wflash bootloader
+YM_ST	equ 0x4000
+YM_B0	equ 0x4000
+YM_B1	equ 0x4002
+PSG	equ 0x7F11
+STACK	equ 0x2000
+CH_PTR	equ 0
+CH_WAIT	equ 2
+CH_FREQ	equ 3
+CH_RET	equ 5
+CH_LOOP	equ 7
+CH_REP	equ 9
+CH_KEY	equ 10
+CH_RCHN	equ 11
+CH_SIZE	equ 12
+SL_PTR	equ 0
+SL_WAIT	equ 2
+SL_TIME	equ 3
+SL_DIVL	equ 4
+SL_DIVH	equ 5
+SL_VOL	equ 6
+SL_SIZE	equ 7
+; Entry point, runs from address 0 after reset
+	di
+	im 1
+	jp init
+	org 0x08
+; Mailbox, written by the 68000 while it owns the bus
+MB_TFC:	dw 0
+MB_PSG:	dw 0
+MB_RATE:	db 0
+MB_SFX_WR:	db 0
+MB_SFX_RD:	db 0
+	db 0
+MB_SFX_Q:	ds 8
+MB_TFC_CH:	ds 12
+; IX = first slot of PSG channel number A
+pa_base:	ld ix,psg_slot-4*SL_SIZE
+	push de
+	ld de,4*SL_SIZE
+	inc a
+pa_badd:	add ix,de
+	dec a
+	jr nz,pa_badd
+	pop de
+	ret
+; 60 Hz frame skip counter
+frame_cnt:	db 0
+; IM 1 interrupt (VBlank), only wakes the main loop from halt
+	org 0x38
+	ei
+	ret
+; Write C to YM2612 register A, bank 0
+ym_wr0:	push iy
+	ld iy,YM_B0
+	call ym_wr
+	pop iy
+	ret
+; Write C to YM2612 register A, bank in IY. Preserves A
+ym_wr:	push af
+ym_w1:	ld a,(YM_ST)
+	add a,a
+	jr c,ym_w1
+	pop af
+	ld (iy+0),a
+	push af
+ym_w2:	ld a,(YM_ST)
+	add a,a
+	jr c,ym_w2
+	pop af
+	ld (iy+1),c
+	ret
+; Mute PSG, start the song and run one frame per VBlank
+init:	ld sp,STACK
+	ld a,0x9f
+psg_m:	ld (PSG),a
+	add a,0x20
+	jr nc,psg_m
+	ld a,(MB_TFC+1)
+	or a
+	call nz,tfc_play
+	ei
+main:	halt
+	call cmd_check
+	ld a,(MB_RATE)
+	or a
+	jr z,tick
+	ld hl,frame_cnt
+	ld a,(hl)
+	inc a
+	cp 6
+	jr c,fc_st
+	xor a
+fc_st:	ld (hl),a
+	dec a
+	jr z,main
+tick:	call tfc_frame
+	call psg_frame
+	jr main
+; Play the sound effects posted to the queue
+cmd_check:	ld a,(MB_SFX_RD)
+	ld b,a
+	ld a,(MB_SFX_WR)
+	cp b
+	ret z
+	ld e,b
+	ld d,0
+	ld hl,MB_SFX_Q
+	add hl,de
+	ld a,b
+	inc a
+	and 7
+	ld (MB_SFX_RD),a
+	ld a,(hl)
+	call psg_play
+	jr cmd_check
+; Set stereo output and channel start pointers
+tfc_play:	ld iy,YM_B0
+	ld hl,MB_TFC_CH
+	ld ix,tfc_chn
+	ld b,6
+tp_ch:	ld a,b
+	cp 3
+	jr nz,tp_sr
+	ld iy,YM_B1
+tp_sr:	ld a,0xb4
+	add a,(ix+CH_RCHN)
+	ld c,0xc0
+	call ym_wr
+	ld e,(hl)
+	inc hl
+	ld d,(hl)
+	inc hl
+	push hl
+	ld hl,(MB_TFC)
+	add hl,de
+	ld (ix+CH_PTR),l
+	ld (ix+CH_PTR+1),h
+	ld (ix+CH_LOOP),l
+	ld (ix+CH_LOOP+1),h
+	pop hl
+	ld de,CH_SIZE
+	add ix,de
+	djnz tp_ch
+	ret
+; TFC player frame, see tfc_frame() history in the C version
+tfc_frame:	ld a,(MB_TFC+1)
+	or a
+	ret z
+	ld ix,tfc_chn
+	ld iy,YM_B0
+	ld b,6
+tf_ch:	ld a,b
+	cp 3
+	jr nz,tf_wait
+	ld iy,YM_B1
+tf_wait:	ld a,(ix+CH_WAIT)
+	inc a
+	jr z,tf_rep
+	ld (ix+CH_WAIT),a
+	jp tf_next
+tf_rep:	ld a,(ix+CH_REP)
+	or a
+	jr z,tf_ptr
+	dec (ix+CH_REP)
+	jr nz,tf_ptr
+	ld a,(ix+CH_RET)
+	ld (ix+CH_PTR),a
+	ld a,(ix+CH_RET+1)
+	ld (ix+CH_PTR+1),a
+tf_ptr:	ld l,(ix+CH_PTR)
+	ld h,(ix+CH_PTR+1)
+tf_tag:	ld a,(hl)
+	inc hl
+	cp 0x7e
+	jr nz,tf_end
+	ld (ix+CH_LOOP),l
+	ld (ix+CH_LOOP+1),h
+	jr tf_tag
+tf_end:	cp 0x7f
+	jr nz,tf_blk
+	ld l,(ix+CH_LOOP)
+	ld h,(ix+CH_LOOP+1)
+	jr tf_tag
+tf_blk:	cp 0xd0
+	jr nz,tf_d16
+	ld a,(hl)
+	inc hl
+	ld (ix+CH_REP),a
+	ld d,(hl)
+	inc hl
+	ld e,(hl)
+	inc hl
+	ld (ix+CH_RET),l
+	ld (ix+CH_RET+1),h
+	add hl,de
+	jr tf_tag
+tf_d16:	cp 0xbf
+	jr nz,tf_d8
+	ld d,(hl)
+	inc hl
+	ld e,(hl)
+	jr tf_old
+tf_d8:	cp 0xff
+	jr nz,tf_skip
+	ld d,0xff
+	ld e,(hl)
+tf_old:	inc hl
+	push hl
+	add hl,de
+	ex de,hl
+	pop hl
+	ld a,(de)
+	inc de
+	call tf_frm
+	jr tf_st
+tf_skip:	cp 0xe0
+	jr c,tf_sld
+	ld (ix+CH_WAIT),a
+	jr tf_st
+tf_sld:	cp 0xc0
+	jr c,tf_new
+	add a,0x30
+	add a,(ix+CH_FREQ)
+	ld (ix+CH_FREQ),a
+	call tf_fwr
+	jr tf_st
+tf_new:	ld d,h
+	ld e,l
+	call tf_frm
+	ex de,hl
+tf_st:	ld (ix+CH_PTR),l
+	ld (ix+CH_PTR+1),h
+tf_next:	ld de,CH_SIZE
+	add ix,de
+	dec b
+	jp nz,tf_ch
+	ret
+; Write frame data at DE with tag A, DE advanced past the data
+tf_frm:	push bc
+	push hl
+	ld b,a
+	and 0xc0
+	jr z,tf_frq
+	ld c,(ix+CH_KEY)
+	ld a,0x28
+	call ym_wr0
+tf_frq:	bit 0,b
+	jr z,tf_regs
+	ld a,(de)
+	inc de
+	ld (ix+CH_FREQ+1),a
+	ld a,(de)
+	inc de
+	ld (ix+CH_FREQ),a
+	call tf_fwr
+tf_regs:	ld a,b
+	rrca
+	and 0x1f
+	jr z,tf_kon
+	ld h,a
+tf_reg:	ld a,(de)
+	inc de
+	ld l,a
+	ld a,(de)
+	inc de
+	ld c,a
+	ld a,l
+	call ym_wr
+	dec h
+	jr nz,tf_reg
+tf_kon:	bit 7,b
+	jr z,tf_fdone
+	ld a,(ix+CH_KEY)
+	or 0xf0
+	ld c,a
+	ld a,0x28
+	call ym_wr0
+tf_fdone:	pop hl
+	pop bc
+	ret
+; Write channel frequency
+tf_fwr:	ld a,(ix+CH_RCHN)
+	add a,0xa4
+	ld c,(ix+CH_FREQ+1)
+	call ym_wr
+	ld a,(ix+CH_RCHN)
+	add a,0xa0
+	ld c,(ix+CH_FREQ)
+	jp ym_wr
+; PSG effects player frame, four virtual slots per channel
+psg_frame:	ld ix,psg_slot
+	ld c,0
+pf_ch:	push ix
+	ld b,4
+pf_sl:	ld a,(ix+SL_PTR+1)
+	or a
+	jr z,pf_snext
+	inc (ix+SL_TIME)
+	ld a,(ix+SL_WAIT)
+	or a
+	jr z,pf_read
+	dec (ix+SL_WAIT)
+	jr pf_snext
+pf_read:	ld l,(ix+SL_PTR)
+	ld h,(ix+SL_PTR+1)
+	ld a,(hl)
+	inc hl
+	ld d,a
+	and 0xc0
+	jr nz,pf_vol
+	or d
+	jr nz,pf_dly
+	ld (ix+SL_PTR+1),a
+	jr pf_snext
+pf_dly:	dec a
+	ld (ix+SL_WAIT),a
+	jr pf_st
+pf_vol:	cp 0x40
+	jr nz,pf_div
+	ld a,d
+	and 0x0f
+	ld (ix+SL_VOL),a
+	jr pf_st
+pf_div:	cp 0x80
+	jr nz,pf_both
+	ld (ix+SL_DIVH),d
+	jr pf_divl
+pf_both:	ld a,d
+	rrca
+	rrca
+	and 0x0f
+	ld (ix+SL_VOL),a
+	ld a,d
+	and 3
+	ld (ix+SL_DIVH),a
+pf_divl:	ld a,(hl)
+	inc hl
+	ld (ix+SL_DIVL),a
+pf_st:	ld (ix+SL_PTR),l
+	ld (ix+SL_PTR+1),h
+pf_snext:	call sl_next
+	djnz pf_sl
+	pop ix
+	ld hl,0
+	ld e,16
+	ld b,4
+pf_min:	ld a,(ix+SL_PTR+1)
+	or a
+	jr z,pf_mnext
+	ld a,(ix+SL_VOL)
+	cp e
+	jr nc,pf_mnext
+	ld e,a
+	push ix
+	pop hl
+pf_mnext:	call sl_next
+	djnz pf_min
+	ld a,h
+	or a
+	jr z,pf_cnext
+	push ix
+	push hl
+	pop ix
+	ld a,(ix+SL_VOL)
+	or c
+	or 0x90
+	ld (PSG),a
+	ld a,(ix+SL_DIVL)
+	ld d,a
+	and 0x0f
+	or c
+	or 0x80
+	ld (PSG),a
+	ld a,(ix+SL_DIVH)
+	xor d
+	and 0x0f
+	xor d
+	rrca
+	rrca
+	rrca
+	rrca
+	ld (PSG),a
+	pop ix
+pf_cnext:	ld a,c
+	add a,0x20
+	ld c,a
+	cp 0x80
+	jp nz,pf_ch
+	ret
+; Start sound effect A
+psg_play:	ld c,a
+	ld hl,(MB_PSG)
+	ld a,(hl)
+	inc hl
+	or a
+	jr nz,pp_ok
+	ld a,c
+	cp (hl)
+	ret nc
+pp_ok:	inc hl
+	ld b,0
+	sla c
+	rl b
+	add hl,bc
+	ld d,(hl)
+	inc hl
+	ld e,(hl)
+	ld hl,(MB_PSG)
+	add hl,de
+	ld b,(hl)
+	inc hl
+pp_eff:	push bc
+	ld d,(hl)
+	inc hl
+	ld e,(hl)
+	inc hl
+	push hl
+	ld hl,(MB_PSG)
+	add hl,de
+	ld a,(hl)
+	inc hl
+	call psg_addch
+	pop hl
+	pop bc
+	djnz pp_eff
+	ret
+; Start effect data at HL on channel A (0 and 1 pick a channel)
+psg_addch:	push hl
+	cp 2
+	jr nc,pa_sel
+	ld c,a
+	ld de,0x0204
+pa_cnt:	ld a,d
+	call pa_base
+	push bc
+	ld bc,0x0400
+pa_act:	ld a,(ix+SL_PTR+1)
+	or a
+	jr z,pa_anext
+	inc c
+pa_anext:	call sl_next
+	djnz pa_act
+	ld a,c
+	pop bc
+	or a
+	jr z,pa_idle
+	cp e
+	jr nc,pa_cnext
+	ld e,a
+	ld c,d
+pa_cnext:	dec d
+	jp p,pa_cnt
+	ld a,c
+	jr pa_sel
+pa_idle:	ld a,d
+pa_sel:	call pa_base
+	push ix
+	pop hl
+	ld e,(ix+SL_TIME)
+	ld b,4
+pa_free:	ld a,(ix+SL_PTR+1)
+	or a
+	jr z,pa_set
+	ld a,e
+	cp (ix+SL_TIME)
+	jr nc,pa_fnext
+	ld e,(ix+SL_TIME)
+	push ix
+	pop hl
+pa_fnext:	call sl_next
+	djnz pa_free
+	push hl
+	pop ix
+pa_set:	pop hl
+	ld (ix+SL_PTR),l
+	ld (ix+SL_PTR+1),h
+	xor a
+	ld (ix+SL_WAIT),a
+	ld (ix+SL_TIME),a
+	ret
+; IX = next slot
+sl_next:	push de
+	ld de,SL_SIZE
+	add ix,de
+	pop de
+	ret
+; TFC channels: ptr, wait, freq, retblk, loop, rep, key, rchn
+tfc_chn:	db 0,0,0xff,0,0,0,0,0,0,0,0,0
+	db 0,0,0xff,0,0,0,0,0,0,0,1,1
+	db 0,0,0xff,0,0,0,0,0,0,0,2,2
+	db 0,0,0xff,0,0,0,0,0,0,0,4,0
+	db 0,0,0xff,0,0,0,0,0,0,0,5,1
+	db 0,0,0xff,0,0,0,0,0,0,0,6,2
+; PSG slots: ptr (0 for idle), wait, time, div, vol
+psg_slot:	ds 16*SL_SIZE
+drv_end:
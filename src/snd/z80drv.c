@@ -0,0 +1,16 @@
+/* Z80 sound driver: TFC music and PSG sound effects players.   */
+/* Z80 port of the C players by Alone Coder and Shiru, trimmed  */
+/* and adapted by doragasu.                                     */
+/*                                                              */
+/* Assembled from z80drv.asm by tool/z80asm.py (run by make).  */
+/* Channel state and the mailbox are part of the image, so it   */
+/* is loaded again each time sound starts.                      */
+
+#include "z80drv.h"
+#include "../util.h"
+
+const uint8_t z80drv[] ROM_DATA(z80drv) = {
+#include "z80drv.inc"
+};
+
+const uint16_t z80drv_len = sizeof(z80drv);
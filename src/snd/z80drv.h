@@ -0,0 +1,53 @@
+/************************************************************************//**
+ * \file
+ *
+ * \brief Z80 sound driver image and mailbox layout.
+ *
+ * Mailbox addresses must match the MB_ labels in z80drv.asm.
+ *
+ * The driver plays the TFC song and PSG sound effects from data copied to
+ * the Z80 RAM just after the image. The 68000 only writes the mailbox,
+ * while it owns the Z80 bus:
+ * - Before starting the driver: data addresses, frame rate and the start
+ *   offsets of the song channels.
+ * - While running: sound effect numbers, posted to a queue.
+ ****************************************************************************/
+
+#ifndef _Z80DRV_H_
+#define _Z80DRV_H_
+
+#include <stdint.h>
+
+/// Z80 RAM reserved at the top for the driver stack
+#define Z80DRV_STACK_LEN	32
+
+/** \addtogroup Z80DrvMbox Z80DrvMbox
+ *  \brief Mailbox fields, as Z80 RAM addresses. 16-bit fields are little
+ *  endian.
+ *  \{ */
+/// TFC data address minus the offset of the first copied byte, 0 for no song
+#define Z80DRV_MB_TFC		0x08
+/// PSG effects data address
+#define Z80DRV_MB_PSG		0x0A
+/// Non-zero to skip one in six frames, for 50 Hz songs on 60 Hz machines
+#define Z80DRV_MB_RATE		0x0C
+/// Effect queue write index, owned by the 68000
+#define Z80DRV_MB_SFX_WR	0x0D
+/// Effect queue read index, owned by the Z80
+#define Z80DRV_MB_SFX_RD	0x0E
+/// Effect queue
+#define Z80DRV_MB_SFX_Q		0x10
+/// Start offsets of the six song channels, as in the TFC header
+#define Z80DRV_MB_TFC_CH	0x18
+/** \} */
+
+/// Effect queue length, must be a power of 2
+#define Z80DRV_SFX_Q_LEN	8
+
+/// Driver image, assembled from z80drv.asm
+extern const uint8_t z80drv[];
+/// Driver image length
+extern const uint16_t z80drv_len;
+
+#endif /*_Z80DRV_H_*/
+
@@ -11,9 +11,25 @@
 #include "flash.h"
 #include "util.h"
 #include "loop.h"
+#include "mpool.h"
+#include "ovl.h"
 #include "globals.h"
 #include "menu_imp/menu_itm.h"
 #include "gfx/background.h"
+#include "snd/sound.h"
+#include "z80scan.h"
+
+/// Put function in the staging overlay, see ovl.h
+#define STAGE_T(name)	SECTION(.stage.text.name)
+
+/// Transfer dashboard refresh period in frames
+#define SF_DASH_FRAMES		MS_TO_FRAMES(250)
+/// First screen line of the transfer dashboard, below the menu items
+#define SF_DASH_LINE		(MENU_LINE_ITEM_FIRST + 8)
+/// Horizontal position of the transfer dashboard
+#define SF_DASH_X		(MENU_PLACE_CENTER + 6)
+/// Length of the transfer dashboard lines
+#define SF_DASH_CHARS		(MENU_LINE_CHARS - 2 * 6)
 
 const char * const lsd_err[] = {
 	"FRAMING ERROR",
@@ -32,16 +48,25 @@ static const char *get_lsd_err(enum lsd_status stat)
 
 /// Local module data structure
 struct sf_data {
-	char *buf[2];		///< Command buffer (double buffered)
+	char *buf[SF_RX_FRAMES_MAX];	///< Frame buffers (ring)
 	uint32_t addr;		///< Address to which write
 	int32_t rem_recv;	///< Remaining bytes to receive
 	int32_t rem_write;	///< Remaining bytes to write
+	uint32_t stage_len;	///< Length of the image being staged
+	uint32_t stage_pos;	///< Staged bytes
+	uint32_t erased_to;	///< Module flash erased up to this address
+	uint32_t xfer_len;	///< Length of the transfer in the dashboard
+	uint32_t xfer_done;	///< Bytes transferred
+	uint16_t xfer_start;	///< Frame in which the transfer started
+	uint16_t errors;	///< Reception errors
 	struct loop_func f;	///< Loop function for flash polling
 	int16_t buf_length;	///< Command buffer length
-	uint16_t recvd[2];	///< Number of bytes received on each buffer
+	/// Number of bytes received on each buffer
+	uint16_t recvd[SF_RX_FRAMES_MAX];
 	uint16_t to_write;	///< Number of bytes from buffer to write
 	/// Menu instance for text drawing
 	struct menu_entry_instance *instance;
+	uint8_t frames;		///< Number of frame buffers
 	uint8_t next_idx;	///< Next empty frame
 	uint8_t avail_idx;	///< Next ready frame
 	uint8_t avail_frames;	///< Available (filled) frames
@@ -50,6 +75,8 @@ struct sf_data {
 		uint8_t busy_flash:1;	///< Flash is erasing/writing data
 		uint8_t busy_recv:1;	///< We are receiving data
 		uint8_t odd:1;		///< Received odd number of bytes
+		uint8_t flash_err:1;	///< Flash programming failed
+		uint8_t stage_overrun:1;///< Staging frames lost, ring was full
 	};
 };
 
@@ -59,10 +86,152 @@ static void cmd_recv_cb(enum lsd_status stat, uint8_t ch,
 static void flash_done_cb(int err, void *ctx);
 static void data_recv_cb(enum lsd_status stat, uint8_t ch,
 		char *data, uint16_t len, void *ctx);
+static void stage_recv_cb(enum lsd_status stat, uint8_t ch,
+		char *data, uint16_t len, void *ctx);
 
 /// Module local data
 static struct sf_data d;
 
+/// Received frame, waiting to be processed by the receive task
+static struct {
+	enum lsd_status stat;
+	uint8_t ch;
+	char *data;
+	uint16_t len;
+	lsd_recv_cb cb;
+} rx;
+
+/// Loop function running receive callbacks in a task, so they can use
+/// the synchronous module functions
+static struct loop_func rx_f;
+
+static void rx_func_cb(struct loop_func *f)
+{
+	loop_func_disable(f);
+	rx.cb(rx.stat, rx.ch, rx.data, rx.len, NULL);
+}
+
+static void rx_defer_cb(enum lsd_status stat, uint8_t ch,
+		char *data, uint16_t len, void *ctx)
+{
+	rx.stat = stat;
+	rx.ch = ch;
+	rx.data = data;
+	rx.len = len;
+	rx.cb = (lsd_recv_cb)ctx;
+	loop_func_enable(&rx_f);
+}
+
+// Receive a frame, processing it from the receive task
+static void sf_recv(char *buf, lsd_recv_cb cb)
+{
+	mw_recv(buf, d.buf_length, (void*)cb, rx_defer_cb);
+}
+
+static uint8_t frame_next(uint8_t idx)
+{
+	idx++;
+	return idx < d.frames ? idx : 0;
+}
+
+// Index of the frame buffer holding data
+static uint8_t frame_idx(const char *data)
+{
+	uint8_t i;
+
+	for (i = 0; i < d.frames; i++) {
+		if (data >= d.buf[i] && data < d.buf[i] + d.buf_length + 2) {
+			return i;
+		}
+	}
+
+	return 0;
+}
+
+// Appends a right aligned number and a label to a dashboard line
+static uint8_t dash_field(char *line, uint8_t pos, uint32_t num,
+		const char *label)
+{
+	pos += long_to_str(MIN(num, 9999), line + pos, 5, 4, ' ');
+	while (*label) {
+		line[pos++] = *label++;
+	}
+
+	return pos;
+}
+
+// Only resident code is used, so it can be drawn while the flash is busy
+static void dash_draw(void)
+{
+	char line[SF_DASH_CHARS + 1];
+	uint16_t elapsed = loop_frame_get() - d.xfer_start;
+	uint32_t rate = 0;
+	uint32_t eta = 0;
+	uint32_t pct = 0;
+	uint8_t pos;
+
+	if (elapsed) {
+		rate = d.xfer_done * (VdpIs60Hz() ? 60 : 50) / elapsed;
+	}
+	if (rate) {
+		eta = (d.xfer_len - d.xfer_done) / rate;
+	}
+	if (d.xfer_len) {
+		pct = d.xfer_done * 100 / d.xfer_len;
+	}
+
+	pos = dash_field(line, 0, rate / 1024, " KB/S  ETA");
+	pos = dash_field(line, pos, eta, " S  ");
+	pos = dash_field(line, pos, pct, "%");
+	line[pos] = '\0';
+	VdpDrawText(VDP_PLANEA_ADDR, SF_DASH_X, SF_DASH_LINE,
+			MENU_COLOR_ITEM_ALT, SF_DASH_CHARS, line, ' ');
+
+	pos = dash_field(line, 0, d.avail_frames, " /");
+	pos = dash_field(line, pos, d.frames, " BUF  ERR");
+	pos = dash_field(line, pos, d.errors, "");
+	line[pos] = '\0';
+	VdpDrawText(VDP_PLANEA_ADDR, SF_DASH_X, SF_DASH_LINE + 2,
+			MENU_COLOR_ITEM_ALT, SF_DASH_CHARS, line, ' ');
+}
+
+static void dash_timer_cb(struct loop_timer *t)
+{
+	UNUSED_PARAM(t);
+	dash_draw();
+}
+
+/// Refreshes the transfer dashboard, never from the receive path
+static struct loop_timer dash_timer = {
+	.timer_cb = dash_timer_cb,
+	.auto_reload = TRUE,
+	.phase_mode = LOOP_PHASE_AUTO
+};
+
+static void dash_start(uint32_t len)
+{
+	d.xfer_len = len;
+	d.xfer_done = 0;
+	d.xfer_start = loop_frame_get();
+	dash_draw();
+	loop_timer_start(&dash_timer, SF_DASH_FRAMES);
+}
+
+static void dash_stop(void)
+{
+	loop_timer_stop(&dash_timer);
+	dash_draw();
+}
+
+// Menu code and font data are read from ROM, wait until flash is readable
+static void rom_wait(void)
+{
+	while (flash_busy()) {
+		flash_poll_proc();
+	}
+}
+
+FS_T(flash_poll_cb)
 static void flash_poll_cb(struct loop_func *f)
 {
 	UNUSED_PARAM(f);
@@ -72,14 +241,38 @@ static void flash_poll_cb(struct loop_func *f)
 void sf_init(char *cmd_buf, int16_t buf_length,
 		struct menu_entry_instance *instance)
 {
+	struct mp_stats stats;
+
 	memset(&d, 0, sizeof(struct sf_data));
 	d.buf[0] = cmd_buf;
 	d.buf[1] = cmd_buf + buf_length + 2;
 	d.buf_length = buf_length;
+	// More frames allow receiving while the flash is slow to program
+	for (d.frames = 2; d.frames < SF_RX_FRAMES_MAX; d.frames++) {
+		mp_stats_get(&stats);
+		if (stats.free < buf_length + 2 + SF_RX_POOL_RESERVE) {
+			break;
+		}
+		d.buf[d.frames] = mp_alloc(buf_length + 2);
+		if (!d.buf[d.frames]) {
+			break;
+		}
+	}
 	d.instance = instance;
 	d.f.func_cb = flash_poll_cb;
 	d.f.disabled = TRUE;
+	// Flash polling must not wait for slow menu or sound callbacks
+	d.f.prio = LOOP_PRIO_HIGH;
 	flash_completion_cb_set(flash_done_cb);
+	if (!rx_f.linked) {
+		rx_f.func_cb = rx_func_cb;
+		rx_f.task = TRUE;
+		rx_f.disabled = TRUE;
+		loop_func_add(&rx_f);
+	}
+	if (!dash_timer.added) {
+		loop_timer_add(&dash_timer);
+	}
 }
 
 // If context is not NULL, command reception is not restarted
@@ -121,7 +314,7 @@ static int sf_cmd_id_get(wf_buf *in, int len)
 
 	// sanity checks
 	if (0 == ByteSwapWord(in->cmd.len) &&
-			WF_HEADLEN == len) {
+			WF_HEADLEN == len && !ovl_load(OVL_FLASH)) {
 		in->cmd.data[0] = FlashGetManId();
 		FlashGetDevId(in->cmd.data + 1);
 		in->cmd.cmd = WF_CMD_OK;
@@ -167,8 +360,9 @@ static int sf_cmd_erase(wf_buf *in, int16_t len, struct menu_item *item)
 	if (((cmd_len + WF_HEADLEN) == len) &&
 			(cmd_len == ByteSwapWord(in->cmd.len))) {
 		menu_str_replace(&item[2].caption, "ERASING...");
-		menu_item_draw(MENU_PLACE_CENTER);
-		if (!FlashRangeErase(ByteSwapDWord(in->cmd.mem.addr),
+		menu_item_redraw(2);
+		if (!OVL_CALL(OVL_FLASH, 1, FlashRangeErase,
+					ByteSwapDWord(in->cmd.mem.addr),
 					ByteSwapDWord(in->cmd.mem.len))) {
 			in->cmd.cmd = WF_CMD_OK;
 		} else {
@@ -186,6 +380,7 @@ static void sf_err_print(const char *err)
 {
 	struct menu_str str = {.str = (char*)err};
 	str.length = strlen(err);
+	rom_wait();
 	menu_str_line_draw(&str, 3, 0, MENU_H_ALIGN_CENTER, 0, 0);
 }
 
@@ -193,16 +388,19 @@ static int frame_check(enum lsd_status stat, char *buf, uint8_t ch,
 		int16_t len, lsd_recv_cb retry_cb)
 {
 	if (LSD_STAT_COMPLETE != stat) {
+		d.errors++;
 		sf_err_print(get_lsd_err(stat));
 		return 1;
 	}
 	if (ch != SF_CHANNEL) {
+		d.errors++;
 		sf_err_print("INVALID CHANNEL!");
-		mw_recv(buf, d.buf_length, NULL, retry_cb);
+		sf_recv(buf, retry_cb);
 		return 1;
 	}
 
 	if (len <= 0) {
+		d.errors++;
 		if (MW_SOCK_TCP_EST != mw_sock_stat_get(SF_CHANNEL)) {
 			// Connection lost
 			sf_err_print("CONNECTION LOST!");
@@ -210,7 +408,7 @@ static int frame_check(enum lsd_status stat, char *buf, uint8_t ch,
 		} else {
 			// No data to process, return error but try again
 			sf_err_print("RECOVERABLE ERROR");
-			mw_recv(buf, d.buf_length, NULL, retry_cb);
+			sf_recv(buf, retry_cb);
 			return 1;
 		}
 	}
@@ -218,11 +416,12 @@ static int frame_check(enum lsd_status stat, char *buf, uint8_t ch,
 	return 0;
 }
 
+FS_T(flash_action)
 static void flash_action(void)
 {
 	char *buf;
 
-	if (!d.busy_recv && (d.rem_recv > 0) && d.avail_frames < 2) {
+	if (!d.busy_recv && (d.rem_recv > 0) && d.avail_frames < d.frames) {
 		d.busy_recv = TRUE;
 		bg_led_draw(VDP_PLANEA_ADDR, 128, 1, 23, 2);
 		buf = d.buf[d.next_idx];
@@ -241,6 +440,7 @@ static void flash_action(void)
 	}
 }
 
+FS_T(flash_done_cb)
 static void flash_done_cb(int err, void *ctx)
 {
 	UNUSED_PARAM(ctx);
@@ -249,6 +449,8 @@ static void flash_done_cb(int err, void *ctx)
 	if (err) {
 		// Programming failed!
 		loop_func_del(&d.f);
+		d.errors++;
+		dash_stop();
 		sf_err_print("PROGRAMMING FAILED!");
 		// TODO Cancel reception of remaining data
 		return;
@@ -258,7 +460,7 @@ static void flash_done_cb(int err, void *ctx)
 		// More data to come
 		d.avail_frames--;
 		d.busy_flash = FALSE;
-		d.avail_idx ^= 1;
+		d.avail_idx = frame_next(d.avail_idx);
 		d.addr += d.to_write;
 		loop_func_disable(&d.f);
 	
@@ -267,15 +469,17 @@ static void flash_done_cb(int err, void *ctx)
 		// We are done. If there are remaining bytes, they are from
 		// a new command following the data transfer
 		loop_func_del(&d.f);
+		dash_stop();
 		remaining = d.recvd[d.avail_idx] - d.to_write;
 		if (0 == remaining) {
                        // Clean end, restart command parser
                        sf_start();
 		} else if (remaining > 0) {
-			// Got next command, process it
-			cmd_recv_cb(LSD_STAT_COMPLETE, SF_CHANNEL,
+			// Got next command, process it from the receive task,
+			// since it might load another overlay
+			rx_defer_cb(LSD_STAT_COMPLETE, SF_CHANNEL,
 					d.buf[d.avail_idx] + d.to_write,
-					remaining, NULL);
+					remaining, (void*)cmd_recv_cb);
 		} else {
 			sf_err_print("RECEIVE LENGHT DOES NOT MATCH");
 		}
@@ -284,6 +488,7 @@ static void flash_done_cb(int err, void *ctx)
 	}
 }
 
+FS_T(data_recv_cb)
 static void data_recv_cb(enum lsd_status stat, uint8_t ch,
 		char *data, uint16_t len, void *ctx)
 {
@@ -294,11 +499,13 @@ static void data_recv_cb(enum lsd_status stat, uint8_t ch,
 	if (err) {
 		loop_func_del(&d.f);
 		d.rem_recv = d.rem_write = -1;
+		dash_stop();
 		// TODO Cancel writing
 		return;
 	}
 
 	d.busy_recv = FALSE;
+	d.xfer_done += len;
 	bg_led_draw(VDP_PLANEA_ADDR, 128, 1, 23, 3);
 	// Add one received byte if we were on odd number of bytes recvd
 	d.recvd[d.next_idx] = len + d.odd;
@@ -313,11 +520,12 @@ static void data_recv_cb(enum lsd_status stat, uint8_t ch,
 	} else {
 		d.odd = FALSE;
 	}
-	d.next_idx ^= 1;
+	d.next_idx = frame_next(d.next_idx);
 
 	flash_action();
 }
 
+FS_T(sf_cmd_program)
 static int sf_cmd_program(wf_buf *in, int16_t len, struct menu_item *item)
 {
 	int ret = len;
@@ -332,7 +540,7 @@ static int sf_cmd_program(wf_buf *in, int16_t len, struct menu_item *item)
 		item[2].caption.length +=
 			uint32_to_hex_str(ByteSwapDWord(in->cmd.mem.addr),
 					item[2].caption.str + 9, 6);
-		menu_item_draw(MENU_PLACE_CENTER);
+		menu_item_redraw(2);
 		
 		in->cmd.len = 0;
 		in->cmd.cmd = WF_CMD_OK;
@@ -342,7 +550,8 @@ static int sf_cmd_program(wf_buf *in, int16_t len, struct menu_item *item)
 		mw_send(WF_CHANNEL, in->sdata, WF_HEADLEN,
 				(void*)1, send_complete_cb);
 		// Start data reception and program
-		d.next_idx = d.avail_idx = d.avail_idx ^ 1;
+		// Data goes after the frame holding the command
+		d.next_idx = d.avail_idx = frame_next(frame_idx((char*)in));
 		d.avail_frames = 0;
 		d.busy_flash = FALSE;
 		bg_led_draw(VDP_PLANEA_ADDR, 128, 1, 23, 3);
@@ -350,6 +559,7 @@ static int sf_cmd_program(wf_buf *in, int16_t len, struct menu_item *item)
 		d.odd = FALSE;
 		loop_func_add(&d.f);
 		loop_func_disable(&d.f);
+		dash_start(d.rem_recv);
 
 		flash_action();
 	} else {
@@ -364,6 +574,197 @@ static int sf_cmd_program(wf_buf *in, int16_t len, struct menu_item *item)
 	return ret;
 }
 
+STAGE_T(stage_write)
+static int stage_write(const char *data, uint16_t len)
+{
+	uint32_t addr = SF_STAGE_IMG_ADDR + d.stage_pos;
+	int err = 0;
+
+	// Erase sectors as needed before writing
+	while (!err && (addr + len) > d.erased_to) {
+		err = mw_flash_sector_erase(d.erased_to / SF_STAGE_SECT_LEN);
+		d.erased_to += SF_STAGE_SECT_LEN;
+	}
+
+	if (!err) {
+		err = mw_flash_write_stream(addr, (const uint8_t*)data, len);
+	}
+
+	return err;
+}
+
+// Module commands use the first buffer, it is not part of the staging ring
+STAGE_T(stage_next)
+static uint8_t stage_next(uint8_t idx)
+{
+	idx++;
+	return idx < d.frames ? idx : 1;
+}
+
+// The host streams the image without waiting between frames. Frames arriving
+// while a module command waits for its reply are queued here, to be written
+// after the command completes.
+STAGE_T(stage_data_cb)
+static void stage_data_cb(enum lsd_status stat, uint8_t ch,
+		char *data, uint16_t len, void *ctx)
+{
+	UNUSED_PARAM(ctx);
+
+	if (LSD_STAT_COMPLETE != stat || SF_CHANNEL != ch || !len) {
+		return;
+	}
+	if (d.avail_frames >= d.frames - 1) {
+		d.stage_overrun = TRUE;
+		return;
+	}
+	memcpy(d.buf[d.next_idx], data, len);
+	d.recvd[d.next_idx] = len;
+	d.next_idx = stage_next(d.next_idx);
+	d.avail_frames++;
+}
+
+STAGE_T(stage_fail)
+static void stage_fail(void)
+{
+	mw_cmd_data_cb_set(NULL);
+	sf_err_print("STAGING FAILED!");
+	d.rem_recv = -1;
+	d.errors++;
+	dash_stop();
+}
+
+STAGE_T(stage_done)
+static void stage_done(char *data, uint16_t remaining)
+{
+	struct menu_item *item = d.instance->entry->item_entry->item;
+	struct sf_stage_hdr hdr;
+	int err;
+
+	dash_stop();
+	hdr.magic = SF_STAGE_MAGIC;
+	hdr.addr = d.addr;
+	hdr.len = d.stage_len;
+	// Header is written last, so incomplete images are never burned. Keep
+	// queuing frames meanwhile, the host might send the next command
+	err = mw_flash_write(SF_STAGE_HDR_ADDR, (uint8_t*)&hdr, sizeof(hdr));
+	mw_cmd_data_cb_set(NULL);
+	if (err || d.stage_overrun) {
+		sf_err_print("STAGING FAILED!");
+		return;
+	}
+	menu_str_replace(&item[2].caption, "IMAGE STAGED");
+	menu_item_redraw(2);
+
+	// Got next command, process it from the receive task,
+	// since it might load another overlay
+	if (remaining) {
+		rx_defer_cb(LSD_STAT_COMPLETE, SF_CHANNEL, data, remaining,
+				(void*)cmd_recv_cb);
+	} else if (d.avail_frames) {
+		rx_defer_cb(LSD_STAT_COMPLETE, SF_CHANNEL,
+				d.buf[d.avail_idx], d.recvd[d.avail_idx],
+				(void*)cmd_recv_cb);
+	} else {
+		sf_start();
+	}
+}
+
+STAGE_T(stage_recv_cb)
+static void stage_recv_cb(enum lsd_status stat, uint8_t ch,
+		char *data, uint16_t len, void *ctx)
+{
+	UNUSED_PARAM(ctx);
+	uint16_t to_write = 0;
+
+	if (frame_check(stat, data, ch, len, stage_recv_cb)) {
+		mw_cmd_data_cb_set(NULL);
+		d.rem_recv = -1;
+		dash_stop();
+		return;
+	}
+
+	// Frame was received on the next empty ring buffer
+	d.recvd[d.next_idx] = len;
+	d.next_idx = stage_next(d.next_idx);
+	d.avail_frames++;
+
+	while (d.avail_frames && d.rem_recv > 0) {
+		bg_led_draw(VDP_PLANEA_ADDR, 128, 1, 23, 3);
+		data = d.buf[d.avail_idx];
+		len = d.recvd[d.avail_idx];
+		to_write = MIN(len, d.rem_recv);
+		if (d.stage_overrun || stage_write(data, to_write)) {
+			stage_fail();
+			return;
+		}
+		d.stage_pos += to_write;
+		d.xfer_done += to_write;
+		d.rem_recv -= to_write;
+		d.avail_idx = stage_next(d.avail_idx);
+		d.avail_frames--;
+	}
+
+	if (d.rem_recv > 0) {
+		bg_led_draw(VDP_PLANEA_ADDR, 128, 1, 23, 2);
+		sf_recv(d.buf[d.next_idx], stage_recv_cb);
+	} else {
+		stage_done(data + to_write, len - to_write);
+	}
+}
+
+STAGE_T(sf_cmd_stage)
+static int sf_cmd_stage(wf_buf *in, int16_t len, struct menu_item *item)
+{
+	int ret = len;
+	uint32_t addr = ByteSwapDWord(in->cmd.mem.addr);
+	uint32_t stage_len = ByteSwapDWord(in->cmd.mem.len);
+	int err = 1;
+
+	// sanity check, image must not overlap the boot sector, and cartridge
+	// flash is written in words
+	if ((len == (ByteSwapWord(in->cmd.len) + WF_HEADLEN)) &&
+			!(addr & 1) && stage_len &&
+			(stage_len <= SF_STAGE_LEN_MAX) &&
+			(stage_len <= GL_PROG_LEN_MAX) &&
+			(addr <= (GL_PROG_LEN_MAX - stage_len))) {
+		menu_str_replace(&item[2].caption, "STAGE: ");
+		item[2].caption.length +=
+			uint32_to_hex_str(addr, item[2].caption.str + 7, 6);
+		menu_item_redraw(2);
+		// Invalidate previous image. Module commands use the first
+		// buffer, so in is not valid after this
+		d.erased_to = SF_STAGE_IMG_ADDR;
+		err = mw_flash_sector_erase(SF_STAGE_HDR_ADDR /
+				SF_STAGE_SECT_LEN);
+	}
+
+	in->cmd.len = 0;
+	if (!err) {
+		in->cmd.cmd = WF_CMD_OK;
+		d.addr = addr;
+		d.rem_recv = d.stage_len = stage_len;
+		d.stage_pos = 0;
+		d.next_idx = d.avail_idx = 1;
+		d.avail_frames = 0;
+		d.stage_overrun = FALSE;
+		mw_cmd_data_cb_set(stage_data_cb);
+		mw_send(WF_CHANNEL, in->sdata, WF_HEADLEN,
+				(void*)1, send_complete_cb);
+		dash_start(stage_len);
+		// Module commands use the first buffer, receive on the others
+		bg_led_draw(VDP_PLANEA_ADDR, 128, 1, 23, 2);
+		sf_recv(d.buf[d.next_idx], stage_recv_cb);
+	} else {
+		sf_err_print("STAGE CMD ERROR!");
+		in->cmd.cmd = ByteSwapWord(WF_CMD_ERROR);
+		ret = -1;
+		mw_send(WF_CHANNEL, in->sdata, WF_HEADLEN,
+				NULL, send_complete_cb);
+	}
+
+	return ret;
+}
+
 static int sf_cmd_run(wf_buf *in, int len)
 {
 	int ret = len;
@@ -435,6 +836,189 @@ static int sf_cmd_bload_addr_get(wf_buf *in, int16_t len)
 	return ret;
 }
 
+#ifdef LOOP_PROFILE
+/// Profiling data of a callback, as sent by WF_CMD_PROF_GET
+struct PACKED sf_prof_entry {
+	uint32_t cb;
+	uint8_t timer;
+	uint8_t pad;
+	uint16_t runs;
+	uint16_t overruns;
+	uint32_t min;
+	uint32_t avg;
+	uint32_t max;
+};
+
+struct sf_prof_dump {
+	struct sf_prof_entry *entry;
+	uint16_t count;
+	uint16_t max;
+};
+
+static void prof_entry_add(uint32_t cb, int timer,
+		const struct loop_prof *prof, void *ctx)
+{
+	struct sf_prof_dump *dump = ctx;
+	struct sf_prof_entry *e = dump->entry + dump->count;
+
+	if (dump->count >= dump->max) {
+		return;
+	}
+	e->cb = ByteSwapDWord(cb);
+	e->timer = timer;
+	e->pad = 0;
+	e->runs = ByteSwapWord(prof->runs);
+	e->overruns = ByteSwapWord(prof->overruns);
+	e->min = ByteSwapDWord(prof->min);
+	e->avg = ByteSwapDWord(prof->avg);
+	e->max = ByteSwapDWord(prof->max);
+	dump->count++;
+}
+
+// Reply: dropped frames (16 bit), entry count (16 bit), entries
+static int sf_cmd_prof_get(wf_buf *in, int16_t len)
+{
+	int ret = len;
+	struct sf_prof_dump dump;
+	uint16_t data_len;
+
+	// sanity check
+	if ((WF_HEADLEN == len) && (0 == ByteSwapWord(in->cmd.len))) {
+		dump.entry = (struct sf_prof_entry*)(in->cmd.data + 4);
+		dump.count = 0;
+		dump.max = (WF_MAX_DATALEN - WF_HEADLEN - 4) /
+			sizeof(struct sf_prof_entry);
+		loop_prof_foreach(prof_entry_add, &dump);
+		in->cmd.wdata[0] = ByteSwapWord(loop_dropped_frames());
+		in->cmd.wdata[1] = ByteSwapWord(dump.count);
+		data_len = 4 + dump.count * sizeof(struct sf_prof_entry);
+		in->cmd.cmd = WF_CMD_OK;
+		in->cmd.len = ByteSwapWord(data_len);
+		mw_send(WF_CHANNEL, in->sdata, WF_HEADLEN + data_len,
+				NULL, send_complete_cb);
+	} else {
+		in->cmd.len = 0;
+		in->cmd.cmd = ByteSwapWord(WF_CMD_ERROR);
+		mw_send(WF_CHANNEL, in->sdata, WF_HEADLEN,
+				NULL, send_complete_cb);
+		ret = -1;
+	}
+
+	return ret;
+}
+#endif
+
+struct PACKED sf_mem_stats {
+	uint32_t used;
+	uint32_t peak;
+	uint32_t free;
+	uint32_t min_free;
+	uint16_t allocs;
+	uint16_t failed;
+	uint16_t guard_err;
+};
+
+static int sf_cmd_mem_get(wf_buf *in, int16_t len)
+{
+	int ret = len;
+	struct sf_mem_stats *reply = (struct sf_mem_stats*)in->cmd.data;
+	struct mp_stats stats;
+
+	// sanity check
+	if ((WF_HEADLEN == len) && (0 == ByteSwapWord(in->cmd.len))) {
+		mp_stats_get(&stats);
+		reply->used = ByteSwapDWord(stats.used);
+		reply->peak = ByteSwapDWord(stats.peak);
+		reply->free = ByteSwapDWord(stats.free);
+		reply->min_free = ByteSwapDWord(stats.min_free);
+		reply->allocs = ByteSwapWord(stats.allocs);
+		reply->failed = ByteSwapWord(stats.failed);
+		reply->guard_err = ByteSwapWord(stats.guard_err);
+		in->cmd.cmd = WF_CMD_OK;
+		in->cmd.len = ByteSwapWord(sizeof(struct sf_mem_stats));
+		mw_send(WF_CHANNEL, in->sdata,
+				WF_HEADLEN + sizeof(struct sf_mem_stats),
+				NULL, send_complete_cb);
+	} else {
+		in->cmd.len = 0;
+		in->cmd.cmd = ByteSwapWord(WF_CMD_ERROR);
+		mw_send(WF_CHANNEL, in->sdata, WF_HEADLEN,
+				NULL, send_complete_cb);
+		ret = -1;
+	}
+
+	return ret;
+}
+
+// The Z80 reads the range while the 68000 keeps the loop running, so the
+// dashboard is refreshed and UART data is serviced during the scan
+static int sf_cmd_scan(wf_buf *in, int16_t len, struct menu_item *item,
+		enum z80scan_mode mode)
+{
+	int ret = len;
+	const int cmd_len = sizeof(struct wf_mem_range);
+	uint32_t addr = ByteSwapDWord(in->cmd.mem.addr);
+	uint32_t scan_len = ByteSwapDWord(in->cmd.mem.len);
+	uint32_t result;
+	uint16_t reply_len;
+
+	// sanity check
+	if (((cmd_len + WF_HEADLEN) == len) &&
+			(cmd_len == ByteSwapWord(in->cmd.len)) &&
+			scan_len && (addr < FLASH_CHIP_LENGTH) &&
+			(scan_len <= (FLASH_CHIP_LENGTH - addr)) &&
+			(Z80SCAN_MODE_BLANK == mode ||
+			 !((addr | scan_len) & 1))) {
+		rom_wait();
+		menu_str_replace(&item[2].caption, Z80SCAN_MODE_BLANK == mode ?
+				"BLANK CHECK..." : "CHECKSUM...");
+		menu_item_redraw(2);
+		sound_deinit();
+		z80scan_start(mode, addr, scan_len);
+		// Z80 reads the 68000 bus, pause it during shadow flush DMA
+		VdpDmaZ80BusReq(TRUE);
+		dash_start(scan_len);
+		while (!z80scan_poll(&d.xfer_done)) {
+			loop_yield();
+		}
+		VdpDmaZ80BusReq(FALSE);
+		result = z80scan_result();
+		d.xfer_done = scan_len;
+		dash_stop();
+		sound_restart();
+		if (Z80SCAN_MODE_BLANK == mode) {
+			*((uint32_t*)in->cmd.data) = ByteSwapDWord(result);
+			reply_len = 4;
+		} else {
+			*((uint16_t*)in->cmd.data) = ByteSwapWord(result);
+			reply_len = 2;
+		}
+		in->cmd.cmd = WF_CMD_OK;
+		in->cmd.len = ByteSwapWord(reply_len);
+		mw_send(WF_CHANNEL, in->sdata, WF_HEADLEN + reply_len,
+				NULL, send_complete_cb);
+	} else {
+		in->cmd.len = 0;
+		in->cmd.cmd = ByteSwapWord(WF_CMD_ERROR);
+		mw_send(WF_CHANNEL, in->sdata, WF_HEADLEN,
+				NULL, send_complete_cb);
+		ret = -1;
+	}
+
+	return ret;
+}
+
+// The overlay with the command code could not be loaded
+static int sf_ovl_err(wf_buf *in)
+{
+	sf_err_print("OVERLAY BUSY");
+	in->cmd.len = 0;
+	in->cmd.cmd = ByteSwapWord(WF_CMD_ERROR);
+	mw_send(WF_CHANNEL, in->sdata, WF_HEADLEN, NULL, send_complete_cb);
+
+	return -1;
+}
+
 static int sf_cmd_proc(wf_buf *in, int16_t len)
 {
 	struct menu_item *item = d.instance->entry->item_entry->item;
@@ -464,7 +1048,8 @@ static int sf_cmd_proc(wf_buf *in, int16_t len)
 
 	// Program flash
 	case WF_CMD_PROGRAM:
-		len = sf_cmd_program(in, len, item);
+		len = OVL_CALL(OVL_FLASH, sf_ovl_err(in), sf_cmd_program,
+				in, len, item);
 		break;
 
 	// Run program from address
@@ -482,6 +1067,34 @@ static int sf_cmd_proc(wf_buf *in, int16_t len)
 		len = sf_cmd_bload_addr_get(in, len);
 		break;
 
+	// Stage data in WiFi module flash
+	case WF_CMD_STAGE:
+		len = OVL_CALL(OVL_STAGE, sf_ovl_err(in), sf_cmd_stage,
+				in, len, item);
+		break;
+
+#ifdef LOOP_PROFILE
+	// Get loop profiling data
+	case WF_CMD_PROF_GET:
+		len = sf_cmd_prof_get(in, len);
+		break;
+#endif
+
+	// Get memory pool statistics
+	case WF_CMD_MEM_GET:
+		len = sf_cmd_mem_get(in, len);
+		break;
+
+	// Check flash range is blank
+	case WF_CMD_BLANK_CHECK:
+		len = sf_cmd_scan(in, len, item, Z80SCAN_MODE_BLANK);
+		break;
+
+	// Checksum flash range
+	case WF_CMD_CHECKSUM:
+		len = sf_cmd_scan(in, len, item, Z80SCAN_MODE_SUM);
+		break;
+
 	default:
 		sf_err_print("FAILED TO PROCESS COMMAND");
 		len = -1;
@@ -504,7 +1117,123 @@ static void cmd_recv_cb(enum lsd_status stat, uint8_t ch,
 }
 
 void sf_start(void) {
-	mw_recv(d.buf[0], d.buf_length, NULL, cmd_recv_cb);
+	sf_recv(d.buf[0], cmd_recv_cb);
+}
+
+FS_T(burn_done_cb)
+static void burn_done_cb(int err, void *ctx)
+{
+	UNUSED_PARAM(ctx);
+
+	loop_func_disable(&d.f);
+	d.flash_err = err ? TRUE : FALSE;
+	d.busy_flash = FALSE;
+}
+
+FS_T(burn_wait)
+static void burn_wait(void)
+{
+	while (d.busy_flash) {
+		flash_poll_proc();
+	}
+}
+
+FS_T(burn)
+static int burn(void)
+{
+	struct menu_item *item = d.instance->entry->item_entry->item;
+	struct sf_stage_hdr hdr;
+	uint8_t *data;
+	char *buf;
+	uint32_t pos;
+	uint32_t next_draw = 0;
+	uint16_t chunk;
+	uint16_t chunk_max;
+	uint8_t idx = 0;
+	int err = 0;
+
+	data = mw_flash_read(SF_STAGE_HDR_ADDR, sizeof(struct sf_stage_hdr));
+	if (!data) {
+		sf_err_print("MODULE FLASH READ FAILED!");
+		return 1;
+	}
+	memcpy(&hdr, data, sizeof(struct sf_stage_hdr));
+	// Do not trust the header, burning over the boot sector would erase
+	// the running bootloader
+	if (SF_STAGE_MAGIC != hdr.magic || !hdr.len || (hdr.addr & 1) ||
+			hdr.len > SF_STAGE_LEN_MAX ||
+			hdr.len > GL_PROG_LEN_MAX ||
+			hdr.addr > (GL_PROG_LEN_MAX - hdr.len)) {
+		sf_err_print("NO STAGED IMAGE!");
+		return 1;
+	}
+
+	menu_str_replace(&item[2].caption, "ERASING...");
+	menu_item_redraw(2);
+	if (FlashRangeErase(hdr.addr, hdr.len)) {
+		sf_err_print("ERASE FAILED!");
+		return 1;
+	}
+
+	d.busy_flash = FALSE;
+	d.flash_err = FALSE;
+	flash_completion_cb_set(burn_done_cb);
+	loop_func_add(&d.f);
+	loop_func_disable(&d.f);
+	// Module commands use the first buffer, the second one is split to
+	// read the next chunk while the previous one is programmed
+	chunk_max = MIN(mw_cmd_data_max(), d.buf_length / 2) & ~1;
+	dash_start(hdr.len);
+	for (pos = 0; !err && pos < hdr.len; pos += chunk) {
+		d.xfer_done = pos;
+		// Cartridge flash is written in words, round length up
+		chunk = MIN(hdr.len - pos, chunk_max);
+		data = mw_flash_read(SF_STAGE_IMG_ADDR + pos, (chunk + 1) & ~1);
+		burn_wait();
+		if (!data || d.flash_err) {
+			err = 1;
+			break;
+		}
+		// Menu code runs from ROM, draw while the flash is idle
+		if (pos >= next_draw) {
+			next_draw += 0x10000;
+			menu_str_replace(&item[2].caption, "BURN: ");
+			item[2].caption.length += uint32_to_hex_str(
+					hdr.addr + pos,
+					item[2].caption.str + 6, 6);
+			menu_item_redraw(2);
+		}
+		buf = d.buf[1] + idx * chunk_max;
+		idx ^= 1;
+		memcpy(buf, data, (chunk + 1) & ~1);
+		d.busy_flash = TRUE;
+		loop_func_enable(&d.f);
+		flash_write_long(hdr.addr + pos, (uint16_t*)buf,
+				(chunk + 1) / 2);
+	}
+	burn_wait();
+	loop_func_del(&d.f);
+	flash_completion_cb_set(flash_done_cb);
+	if (!err && !d.flash_err) {
+		d.xfer_done = hdr.len;
+	} else {
+		d.errors++;
+	}
+	dash_stop();
+
+	if (err || d.flash_err) {
+		sf_err_print("PROGRAMMING FAILED!");
+		return 1;
+	}
+	menu_str_replace(&item[2].caption, "BURN COMPLETE");
+	menu_item_redraw(2);
+
+	return 0;
+}
+
+int sf_burn(void)
+{
+	return OVL_CALL(OVL_FLASH, 1, burn);
 }
 
 /************************************************************************//**
@@ -516,28 +1245,19 @@ void sf_start(void) {
 void boot_addr(uint32_t addr);
 
 void sf_boot(uint32_t addr, int quick) {
-	int i;
-
+#ifdef LOOP_PROFILE
+	sf_boot_prof.entry_frame = loop_frame_get();
+#endif
 	if (!quick) {
 		// Wait between 1 and 2 frames for the message to be sent
 		mw_sleep(2);
 	}
 
+	// Z80 and YM2612 are left in reset, as after power on
+	sound_deinit();
 	VdpDisable();
-
-	// Clear CRAM
-	VdpRamRwPrep(VDP_CRAM_WR, 0);
-	for (i = 64; i > 0; i--) VDP_DATA_PORT_W = 0;
-
-	// Clear VRAM
-	VdpRamRwPrep(VDP_VRAM_WR, 0);
-	for (i = 32768; i > 0; i--) VDP_DATA_PORT_W = 0;
-
-	// Clear VSRAM
-	VdpRamRwPrep(VDP_VSRAM_WR, 0);
-	for (i = 40; i > 0; i--) VDP_DATA_PORT_W = 0;
-	
-	VdpEnable();
+	// VRAM is cleared by DMA while the module is put to sleep
+	VdpMemClearStart();
 
 	if (!quick) {
 		// Put module to sleep
@@ -545,6 +1265,13 @@ void sf_boot(uint32_t addr, int quick) {
 		mw_sleep(2);
 	}
 
+	VdpMemClearWait();
+	VdpEnable();
+
+#ifdef LOOP_PROFILE
+	sf_boot_prof.handoff_frames = loop_frame_get() -
+		sf_boot_prof.entry_frame;
+#endif
 	// boot
 	boot_addr(addr);
 }
@@ -14,6 +14,7 @@
 
 #include <stdint.h>
 #include "mw/megawifi.h"
+#include "globals.h"
 #include "menu_imp/menu.h"
 
 /// Default channel to use for MegaWiFi communications
@@ -22,6 +23,13 @@
 /// Default port to use for MegaWiFi communications
 #define SF_PORT         1989
 
+/// Maximum number of frame buffers used while receiving data to program.
+/// Two are in the command buffer, the rest are allocated from the pool.
+#define SF_RX_FRAMES_MAX	16
+
+/// Pool memory left free when allocating receive frame buffers
+#define SF_RX_POOL_RESERVE	4096
+
 /// Maximum number of characters to draw per line
 #define SF_LINE_MAXCHARS	(VDP_SCREEN_WIDTH_PX/8 - 1)
 
@@ -32,8 +40,42 @@
 /// Bootloader address is currently the 68000 start entry
 #define SF_BOOTLOADER_ADDR	(*((uint32_t*)0x000004))
 
+/// Module flash sector length
+#define SF_STAGE_SECT_LEN	4096
+
+/// Length of the module flash area usable for image staging. Address 0 as
+/// seen by mw_flash_*() functions, is 0x80000 in the module flash chip.
+/// Staging area ends where the AP association cache starts.
+#define SF_STAGE_AREA_LEN	GL_MW_FLASH_AP_CACHE_ADDR
+
+/// Module flash address of the staged image header
+#define SF_STAGE_HDR_ADDR	0
+
+/// Module flash address of the staged image data
+#define SF_STAGE_IMG_ADDR	SF_STAGE_SECT_LEN
+
+/// Maximum length of an image that can be staged
+#define SF_STAGE_LEN_MAX	(SF_STAGE_AREA_LEN - SF_STAGE_IMG_ADDR)
+
+/// Marks a complete staged image
+#define SF_STAGE_MAGIC		0x57465354
+
+/// Header describing an image staged in module flash
+struct sf_stage_hdr {
+	uint32_t magic;		///< SF_STAGE_MAGIC if image is complete
+	uint32_t addr;		///< Cartridge address to burn the image to
+	uint32_t len;		///< Image length
+};
+
 /************************************************************************//**
  * Module initialization. Call this function before using this module.
+ *
+ * Besides the two frames in cmd_buf, additional receive frame buffers are
+ * allocated from the memory pool, while there is enough free memory.
+ *
+ * \param[in] cmd_buf    Command buffer, holding two frames.
+ * \param[in] buf_length Length of each frame.
+ * \param[in] instance   Menu instance used to draw status text.
  ****************************************************************************/
 void sf_init(char *cmd_buf, int16_t buf_length,
 		struct menu_entry_instance *instance);
@@ -45,6 +87,34 @@ void sf_init(char *cmd_buf, int16_t buf_length,
  ****************************************************************************/
 void sf_start(void);
 
+/************************************************************************//**
+ * Burn the image staged in the WiFi module flash into the cartridge. The
+ * image is read from the module while the previous chunk is programmed, so
+ * no network activity is involved. The staged image is kept, and can be
+ * burned again into another cartridge.
+ *
+ * \return 0 if OK, non-zero if error.
+ * \note sf_init() must be called before using this function.
+ ****************************************************************************/
+int sf_burn(void);
+
+#ifdef LOOP_PROFILE
+/// Boot timing measured by sf_boot(), in frames. The loop starts counting
+/// shortly after reset, so entry_frame + handoff_frames is the time from
+/// reset to the jump to the program entry point. The program takes over the
+/// machine, so read it with a debugger (e.g. `make debug`) stopped at the
+/// program entry point.
+struct sf_boot_prof {
+	uint16_t entry_frame;		///< Frame in which sf_boot() was called
+	uint16_t handoff_frames;	///< Frames from sf_boot() to the jump
+};
+
+/// Boot timing of the last sf_boot() call. Defined by the linker script in
+/// the .dirty area (right after dirty_dw), which is not cleared before
+/// jumping to the program.
+extern struct sf_boot_prof sf_boot_prof;
+#endif
+
 /************************************************************************//**
  * Clear environment and boot from specified address.
  *
@@ -2,11 +2,40 @@
 #include "vdp.h"
 #include "gfx/font.h"
 #include "util.h"
+#include "mpool.h"
+#include "z80.h"
+
+/// Number of cells in the plane RAM shadow
+#define SHADOW_CELLS	(VDP_SHADOW_ROWS * VDP_PLANE_HTILES)
 
 /// VDP shadow register values.
 static uint8_t vdpRegShadow[VDP_REG_MAX];
 static uint16_t palShadow[4][16];
 
+/// RAM shadow of the top rows of VDP_SHADOW_PLANE
+static uint16_t shadow[SHADOW_CELLS];
+/// Dirty cells of each shadow row, from x0 to x1 - 1 (x1 is 0 if clean)
+static struct {
+	uint8_t x0;
+	uint8_t x1;
+} dirty[VDP_SHADOW_ROWS];
+/// There are dirty rows pending to be flushed
+static uint8_t shadow_pending;
+/// Row to start the next flush from
+static uint8_t flush_row;
+/// Shadow is not flushed anymore, VRAM was cleared to boot a program
+static uint8_t flush_off;
+/// Z80 bus is requested around 68000 to VDP DMA transfers
+static uint8_t dma_bus_req;
+
+/// Writes consecutive cells, to the shadow or directly to VRAM
+struct cell_wr {
+	int16_t pos;	///< Shadow cell, negative when writing to VRAM
+	uint16_t num;	///< Cells written
+	uint16_t c0;	///< First shadow cell changed
+	uint16_t c1;	///< Last shadow cell changed, plus one
+};
+
 /// Mask used to build control port data for VDP RAM writes.
 /// Bits 15 and 14: CD1 and CD0.
 /// Bits 7 to 4: CD5 to CD2.
@@ -87,6 +116,87 @@ static inline void VdpRegWrite(uint8_t reg, uint8_t value) {
 	VDP_CTRL_PORT_W = 0x8000 | (reg<<8) | value;
 }
 
+// Shadow cell of a VRAM address, -1 if the address is not in the shadow
+static int16_t shadow_pos(uint16_t addr)
+{
+	uint16_t pos = (addr - VDP_SHADOW_PLANE) / 2;
+
+	if (addr < VDP_SHADOW_PLANE || pos >= SHADOW_CELLS) {
+		return -1;
+	}
+
+	return pos;
+}
+
+static void shadow_mark(uint16_t pos, uint16_t num)
+{
+	uint16_t end = MIN(pos + num, SHADOW_CELLS);
+	uint8_t row, x0, x1;
+
+	while (pos < end) {
+		row = pos / VDP_PLANE_HTILES;
+		x0 = pos % VDP_PLANE_HTILES;
+		x1 = MIN(end - row * VDP_PLANE_HTILES, VDP_PLANE_HTILES);
+		if (dirty[row].x1) {
+			dirty[row].x0 = MIN(dirty[row].x0, x0);
+			dirty[row].x1 = MAX(dirty[row].x1, x1);
+		} else {
+			dirty[row].x0 = x0;
+			dirty[row].x1 = x1;
+		}
+		pos = (row + 1) * VDP_PLANE_HTILES;
+	}
+	shadow_pending = TRUE;
+}
+
+static void wr_start(struct cell_wr *w, uint16_t addr)
+{
+	w->pos = shadow_pos(addr);
+	w->num = 0;
+	w->c0 = SHADOW_CELLS;
+	w->c1 = 0;
+	if (w->pos < 0) {
+		VdpDmaWait();
+		VdpRegWrite(VDP_REG_INCR, 0x02);
+		VdpRamRwPrep(VDP_VRAM_WR, addr);
+	}
+}
+
+// Write started inside the shadow continues past its end, directly to VRAM
+static void wr_shadow_leave(void)
+{
+	VdpDmaWait();
+	VdpRegWrite(VDP_REG_INCR, 0x02);
+	VdpRamRwPrep(VDP_VRAM_WR, VDP_SHADOW_PLANE + 2 * SHADOW_CELLS);
+}
+
+// Cells already holding the written value are not marked as dirty
+static inline void wr_put(struct cell_wr *w, uint16_t cell)
+{
+	uint16_t pos = w->pos + w->num;
+
+	if (w->pos < 0) {
+		VDP_DATA_PORT_W = cell;
+	} else if (pos >= SHADOW_CELLS) {
+		if (pos == SHADOW_CELLS) {
+			wr_shadow_leave();
+		}
+		VDP_DATA_PORT_W = cell;
+	} else if (shadow[pos] != cell) {
+		shadow[pos] = cell;
+		w->c0 = MIN(w->c0, pos);
+		w->c1 = pos + 1;
+	}
+	w->num++;
+}
+
+static void wr_end(struct cell_wr *w)
+{
+	if (w->c1 > w->c0) {
+		shadow_mark(w->c0, w->c1 - w->c0);
+	}
+}
+
 void VdpInit(void) {
 	uint16_t i;
 
@@ -97,14 +207,18 @@ void VdpInit(void) {
 	// Clear CRAM
 	VdpRamRwPrep(VDP_CRAM_WR, 0);
 	for (i = 64; i > 0; i--) VDP_DATA_PORT_W = 0;
-	// Clear VRAM
-	/// \bug I do not know why, but VRam Fill does not work. I suspect it
-	/// has something to do with transfer length.
-//	VdpDmaVRamFill(0, 0, 0);
-//	VdpDmaWait();
+	// Clear VRAM. DMA is still disabled in mode register 2 here, so DMA
+	// fill cannot be used (VdpMemClearStart() uses it)
 	VdpRamRwPrep(VDP_VRAM_WR, 0);
 	for (i = 32768; i > 0; i--) VDP_DATA_PORT_W = 0;
-
+	memset(shadow, 0, sizeof(shadow));
+	memset(dirty, 0, sizeof(dirty));
+	shadow_pending = FALSE;
+	flush_row = 0;
+	flush_off = FALSE;
+
+	// Enable DMA (display still disabled), used to load the font
+	VdpRegWrite(VDP_REG_MODE2, 0x14);
 	// Load font three times, to be able to use three different colors
 	VdpFontLoad(font, FONT_NCHARS, 0, 1, 0);
 	VdpFontLoad(font, FONT_NCHARS, FONT_NCHARS * 32, 2, 0);
@@ -135,70 +249,56 @@ void VdpInit(void) {
 
 void VdpDrawText(uint16_t planeAddr, uint8_t x, uint8_t y, uint8_t txtColor,
 		uint8_t maxChars, const char *text, char fillChar) {
-	uint16_t offset;
+	struct cell_wr w;
 	uint16_t i;
 
-	// Set auto increment
-	VdpRegWrite(VDP_REG_INCR, 0x02);
-	// Calculate nametable offset and prepare VRAM writes
-	offset = planeAddr + 2 *(x + y * VDP_PLANE_HTILES);
-	VdpRamRwPrep(VDP_VRAM_WR, offset);
-
+	wr_start(&w, planeAddr + 2 * (x + y * VDP_PLANE_HTILES));
 	for (i = 0; text[i] && i < maxChars; i++) {
-		VDP_DATA_PORT_W = text[i] - ' ' + txtColor;
+		wr_put(&w, text[i] - ' ' + txtColor);
 	}
 	while (fillChar && i < maxChars) {
-		VDP_DATA_PORT_W = fillChar - ' ' + txtColor;
+		wr_put(&w, fillChar - ' ' + txtColor);
 		i++;
 	}
+	wr_end(&w);
 }
 
 void VdpDrawChars(uint16_t planeAddr, uint8_t x, uint8_t y, uint8_t txtColor,
 		uint8_t numChars, const char *text) {
-	uint16_t offset;
+	struct cell_wr w;
 	uint16_t i;
 
-	// Set auto increment
-	VdpRegWrite(VDP_REG_INCR, 0x02);
-	// Calculate nametable offset and prepare VRAM writes
-	offset = planeAddr + 2 *(x + y * VDP_PLANE_HTILES);
-	VdpRamRwPrep(VDP_VRAM_WR, offset);
-
+	wr_start(&w, planeAddr + 2 * (x + y * VDP_PLANE_HTILES));
 	for (i = 0; i < numChars; i++) {
-		VDP_DATA_PORT_W = text[i] - ' ' + txtColor;
+		wr_put(&w, text[i] - ' ' + txtColor);
 	}
+	wr_end(&w);
 }
 
 void VdpDrawHex(uint16_t planeAddr, uint8_t x, uint8_t y, uint8_t txtColor,
 		uint8_t num) {
-	uint16_t offset;
+	struct cell_wr w;
 	uint8_t tmp;
 
-	// Set auto increment
-	VdpRegWrite(VDP_REG_INCR, 0x02);
-	// Calculate nametable offset and prepare VRAM writes
-	offset = planeAddr + 2 * (x + y * VDP_PLANE_HTILES);
-	VdpRamRwPrep(VDP_VRAM_WR, offset);
-
+	wr_start(&w, planeAddr + 2 * (x + y * VDP_PLANE_HTILES));
 	// Write hex byte
 	tmp = num>>4;
-	VDP_DATA_PORT_W = txtColor + (tmp > 9?tmp - 10 + 0x21:tmp + 0x10);
+	wr_put(&w, txtColor + (tmp > 9?tmp - 10 + 0x21:tmp + 0x10));
 	tmp = num & 0xF;
-	VDP_DATA_PORT_W = txtColor + (tmp > 9?tmp - 10 + 0x21:tmp + 0x10);
+	wr_put(&w, txtColor + (tmp > 9?tmp - 10 + 0x21:tmp + 0x10));
+	wr_end(&w);
 }
 
 uint8_t VdpDrawDec(uint16_t planeAddr, uint8_t x, uint8_t y, uint8_t txtColor,
 		uint8_t num) {
-	uint16_t offset;
+	struct cell_wr w;
 	uint8_t len, i;
 	char str[4];
 
-	// Calculate nametable offset and prepare VRAM writes
-	offset = planeAddr + 2 * (x + y * VDP_PLANE_HTILES);
-	VdpRamRwPrep(VDP_VRAM_WR, offset);
-
+	wr_start(&w, planeAddr + 2 * (x + y * VDP_PLANE_HTILES));
 	len = uint8_to_str(num, str);
-	for (i = 0; i < len; i++) VDP_DATA_PORT_W = txtColor + 0x10 - '0' + str[i];
+	for (i = 0; i < len; i++) wr_put(&w, txtColor + 0x10 - '0' + str[i]);
+	wr_end(&w);
 
 	return i;
 }
@@ -232,33 +332,51 @@ void VdpMapLoad(const uint16_t *map, const uint16_t vram_addr, uint8_t map_width
 
 void VdpFontLoad(const uint32_t *font, uint8_t chars, uint16_t addr,
 		uint8_t fgcol, uint8_t bgcol) {
+	uint16_t px[16];
 	uint32_t line;
-	uint32_t scratch;
+	uint32_t *tiles;
+	uint32_t *out;
 	int16_t i;
-	int8_t j, k;
+	int8_t j;
 
-	// Set auto increment
-	VdpRegWrite(VDP_REG_INCR, 0x02);
-	// Prepare write
-	VdpRamRwPrep(VDP_VRAM_WR, addr);
-	// Note font is 1bpp, and it expanded to 4bpp during load
+	// Pixels for each 4-bit font group, first pixel in the lower bit
+	for (i = 0; i < 16; i++) {
+		px[i] = 0;
+		for (j = 0; j < 4; j++) {
+			px[i] = (px[i]<<4) | ((i>>j) & 1?fgcol:bgcol);
+		}
+	}
 
-	// Each char takes two DWORDs	
+	// Font is 1bpp, expanded to 4bpp in RAM and sent with DMA. If there
+	// is no memory available, expanded pixels are written to the port
+	tiles = mp_alloc(32 * chars);
+	if (!tiles) {
+		VdpRegWrite(VDP_REG_INCR, 0x02);
+		VdpRamRwPrep(VDP_VRAM_WR, addr);
+	}
+
+	// Each char takes two DWORDs, each DWORD expands to 4 VDP DWORDs
+	out = tiles;
 	for (i = 0; i < 2 * chars; i++) {
 		line = font[i];
-		// Process a 32-bit font input
-		for (j = 0; j < 4; j++) {
-			scratch = 0;
-			// Process 8 bits to create 1 VDP DWORD
-			for (k = 0; k < 8; k++) {
-				scratch<<=4;
-				scratch |= line & 1?fgcol:bgcol;
-				line>>=1;
+		for (j = 0; j < 4; j++, line >>= 8) {
+			if (tiles) {
+				*out++ = ((uint32_t)px[line & 0xF]<<16) |
+					px[(line>>4) & 0xF];
+			} else {
+				VDP_DATA_PORT_DW = ((uint32_t)px[line & 0xF]<<16) |
+					px[(line>>4) & 0xF];
 			}
-			// Write 32-bit value to VDP
-			VDP_DATA_PORT_DW = scratch;
 		}
 	}
+
+	if (tiles) {
+		VdpDmaWait();
+		VdpRegWrite(VDP_REG_INCR, 0x02);
+		VdpDma((uint32_t)tiles, addr, 16 * chars, VDP_DMA_MEM_VRAM);
+		VdpDmaWait();
+		mp_free_to(tiles);
+	}
 }
 
 void VdpDma(uint32_t src, uint16_t dst, uint16_t wLen, uint16_t mem) {
@@ -273,7 +391,19 @@ void VdpDma(uint32_t src, uint16_t dst, uint16_t wLen, uint16_t mem) {
 	VdpRegWrite(VDP_REG_DMASRC3, src>>17);
 	// Write command and start DMA
 	cmd = (dst>>14) | (mem & 0xFF) | (((dst & 0x3FFF) | (mem & 0xFF00))<<16);
+	if (dma_bus_req) {
+		z80_bus_req();
+	}
 	VDP_CTRL_PORT_DW = cmd;
+	// 68000 is halted until the transfer ends, bus can be released now
+	if (dma_bus_req) {
+		z80_bus_rel();
+	}
+}
+
+void VdpDmaZ80BusReq(int req)
+{
+	dma_bus_req = req;
 }
 
 void VdpDmaVRamFill(uint16_t dst, uint16_t len, uint16_t incr, uint16_t fill) {
@@ -319,6 +449,122 @@ void VdpLineClear(uint16_t planeAddr, uint8_t line) {
 	VdpDmaVRamFill(start, 40 * 2, 1, 0);
 }
 
+void VdpCellsWrite(uint16_t addr, const uint16_t *cells, uint16_t num)
+{
+	struct cell_wr w;
+
+	wr_start(&w, addr);
+	while (num--) {
+		wr_put(&w, *cells++);
+	}
+	wr_end(&w);
+}
+
+void VdpCellsFill(uint16_t addr, uint16_t value, uint16_t num)
+{
+	struct cell_wr w;
+
+	wr_start(&w, addr);
+	while (num--) {
+		wr_put(&w, value);
+	}
+	wr_end(&w);
+}
+
+void VdpCellsCopy(uint16_t src, uint16_t dst, uint16_t num)
+{
+	int16_t src_pos = shadow_pos(src);
+	int16_t dst_pos = shadow_pos(dst);
+	uint16_t i;
+
+	if (src_pos >= 0 && dst_pos >= 0) {
+		num = MIN(num, SHADOW_CELLS - MAX(src_pos, dst_pos));
+		memmove(shadow + dst_pos, shadow + src_pos, 2 * num);
+		shadow_mark(dst_pos, num);
+	} else if (src_pos >= 0) {
+		VdpCellsWrite(dst, shadow + src_pos,
+				MIN(num, SHADOW_CELLS - src_pos));
+	} else if (dst_pos >= 0) {
+		num = MIN(num, SHADOW_CELLS - dst_pos);
+		VdpDmaWait();
+		VdpRegWrite(VDP_REG_INCR, 0x02);
+		VdpRamRwPrep(VDP_VRAM_RD, src);
+		for (i = 0; i < num; i++) {
+			shadow[dst_pos + i] = VDP_DATA_PORT_W;
+		}
+		shadow_mark(dst_pos, num);
+	} else {
+		VdpDmaWait();
+		VdpDmaVRamCopy(src, dst, 2 * num);
+		VdpDmaWait();
+	}
+}
+
+int VdpShadowPending(void)
+{
+	return shadow_pending && !flush_off;
+}
+
+void VdpShadowFlush(void)
+{
+	uint16_t budget = VDP_SHADOW_FLUSH_MAX;
+	uint16_t pos, len;
+	uint8_t row = flush_row;
+	uint8_t i;
+
+	if (!shadow_pending || flush_off) {
+		return;
+	}
+
+	VdpDmaWait();
+	VdpRegWrite(VDP_REG_INCR, 0x02);
+	for (i = 0; i < VDP_SHADOW_ROWS; i++) {
+		if (dirty[row].x1) {
+			len = dirty[row].x1 - dirty[row].x0;
+			if (len > budget) {
+				// Continue from this row on next flush
+				break;
+			}
+			pos = row * VDP_PLANE_HTILES + dirty[row].x0;
+			VdpDma((uint32_t)(shadow + pos),
+					VDP_SHADOW_PLANE + 2 * pos, len,
+					VDP_DMA_MEM_VRAM);
+			dirty[row].x1 = 0;
+			budget -= len;
+		}
+		row = row + 1 < VDP_SHADOW_ROWS ? row + 1 : 0;
+	}
+	flush_row = row;
+	shadow_pending = i < VDP_SHADOW_ROWS;
+}
+
+void VdpMemClearStart(void)
+{
+	uint16_t i;
+
+	// Shadow contents must not be flushed over the cleared VRAM
+	flush_off = TRUE;
+
+	VdpDmaWait();
+	VdpRegWrite(VDP_REG_INCR, 0x02);
+	VdpRamRwPrep(VDP_CRAM_WR, 0);
+	for (i = 64; i > 0; i--) VDP_DATA_PORT_W = 0;
+	VdpRamRwPrep(VDP_VSRAM_WR, 0);
+	for (i = 40; i > 0; i--) VDP_DATA_PORT_W = 0;
+
+	// Do not rely on a zero length wrapping around to 64 KiB: fill up to
+	// the last word, that is cleared by VdpMemClearWait()
+	VdpDmaVRamFill(0, 0xFFFE, 1, 0);
+}
+
+void VdpMemClearWait(void)
+{
+	VdpDmaWait();
+	VdpRegWrite(VDP_REG_INCR, 0x02);
+	VdpRamRwPrep(VDP_VRAM_WR, 0xFFFE);
+	VDP_DATA_PORT_W = 0;
+}
+
 void VdpVBlankWait(void) {
 	while ((VDP_CTRL_PORT_W & VDP_STAT_VBLANK));
 	while ((VDP_CTRL_PORT_W & VDP_STAT_VBLANK) == 0);
@@ -338,6 +584,13 @@ void VdpEnable(void)
 	VdpRegWrite(VDP_REG_MODE2, vdpRegShadow[VDP_REG_MODE2] | 0x40);
 }
 
+void VdpWinBottomSet(uint8_t rows)
+{
+	// Window from the specified cell row to the bottom of the screen
+	VdpRegWrite(VDP_REG_WIN_VPOS, rows ? 0x80 | (VDP_SCREEN_VTILES - rows) :
+			0x00);
+}
+
 void VdpPalLoad(const uint16_t *pal, uint8_t pal_no)
 {
 	VdpDma((uint32_t)pal, pal_no * 32, 16, VDP_DMA_MEM_CRAM);
@@ -5,6 +5,13 @@
  * - Font loading and colour text drawing on planes. 
  * No sprites or any other fancy stuff.
  *
+ * The visible rows of plane A (used by the menus) have a shadow copy in
+ * RAM. Text drawing and VdpCells*() calls on these rows write to the shadow
+ * and mark the cells whose value changed as dirty, so redrawing unchanged
+ * text costs no VRAM bandwidth. Dirty cells are sent to VRAM by
+ * VdpShadowFlush(), using DMA, that should be called during VBlank.
+ * Other planes are directly written to VRAM.
+ *
  * \author Jesús Alonso (doragasu)
  * \date 2017
  * \defgroup vdp vdp
@@ -23,6 +30,12 @@
 // Number of tiles per horizontal plane line
 #define VDP_PLANE_HTILES		128
 
+// Number of tile rows on screen
+#define VDP_SCREEN_VTILES		(VDP_SCREEN_HEIGHT_PX / 8)
+
+// Number of tiles per horizontal window plane line (H40 mode)
+#define VDP_WIN_HTILES			64
+
 /// Version register address. Not strictly part of the VDP, but it is handy
 /// having it here for refresh rate detection
 #define VDP_VERSION_REG_ADDR 0xA10000
@@ -110,6 +123,17 @@
 #define VDP_TXT_COL_MAGENTA	0xC0
 /** \} */
 
+/// Plane with a RAM shadow
+#define VDP_SHADOW_PLANE	VDP_PLANEA_ADDR
+/// Number of rows of the plane in the RAM shadow, starting from the top
+#define VDP_SHADOW_ROWS		VDP_SCREEN_VTILES
+/// Maximum number of words sent to VRAM by each VdpShadowFlush() call,
+/// fitting in the VBlank interval
+#define VDP_SHADOW_FLUSH_MAX	2048
+
+/// DMA transfers from 68000 memory cannot cross multiples of this address
+#define VDP_DMA_BOUNDARY	0x20000
+
 #define VDP_DMA_68K		(0x00<<6)
 #define VDP_DMA_FILL		(0x02<<6)
 #define VDP_DMA_COPY		(0x03<<6)
@@ -264,10 +288,28 @@ void VdpDmaVRamFill(uint16_t dst, uint16_t len, uint16_t incr, uint16_t fill);
  ****************************************************************************/
 void VdpDma(uint32_t src, uint16_t dst, uint16_t wLen, uint16_t mem);
 
+/************************************************************************//**
+ * Request the Z80 bus around DMA transfers started by VdpDma().
+ *
+ * 68000 memory must not be accessed by the Z80 (through the bank window)
+ * while a 68000 to VDP DMA is in progress. Enable this while a Z80 program
+ * reads 68000 memory, it is paused during each transfer.
+ *
+ * \param[in] req TRUE to request the bus around transfers, FALSE to stop.
+ *
+ * \warning Only enable it while the Z80 is running (not in reset), the bus
+ * is not granted otherwise.
+ ****************************************************************************/
+void VdpDmaZ80BusReq(int req);
+
 /************************************************************************//**
  * Loads a 1bpp font on the VRAM, setting specified foreground and
  * background colours.
  *
+ * The font is expanded to 4bpp using a lookup table, into a temporary buffer
+ * from the memory pool that is sent to VRAM with DMA. Requires mp_init()
+ * to be called first for the DMA transfer to be used.
+ *
  * \param[in] font  Array containing the 1bpp font (8 bytes per character).
  * \param[in] chars Number of characters contained in font.
  * \param[in] addr  VRAM Address to load the font in.
@@ -417,6 +459,68 @@ void VdpDrawU32(uint16_t planeAddr, uint8_t x, uint8_t y, uint8_t txtColor,
 uint8_t VdpDrawDec(uint16_t planeAddr, uint8_t x, uint8_t y, uint8_t txtColor,
 		uint8_t num);
 
+/************************************************************************//**
+ * Write cells (nametable entries) to a plane.
+ *
+ * \param[in] addr  VRAM address of the first cell.
+ * \param[in] cells Cells to write.
+ * \param[in] num   Number of cells to write.
+ ****************************************************************************/
+void VdpCellsWrite(uint16_t addr, const uint16_t *cells, uint16_t num);
+
+/************************************************************************//**
+ * Fill cells (nametable entries) of a plane with a value.
+ *
+ * \param[in] addr  VRAM address of the first cell.
+ * \param[in] value Value to write to the cells.
+ * \param[in] num   Number of cells to fill.
+ ****************************************************************************/
+void VdpCellsFill(uint16_t addr, uint16_t value, uint16_t num);
+
+/************************************************************************//**
+ * Copy cells (nametable entries) of a plane.
+ *
+ * \param[in] src VRAM address of the first cell to copy.
+ * \param[in] dst VRAM address of the first destination cell.
+ * \param[in] num Number of cells to copy.
+ ****************************************************************************/
+void VdpCellsCopy(uint16_t src, uint16_t dst, uint16_t num);
+
+/************************************************************************//**
+ * Check if the RAM shadow has cells pending to be sent to VRAM.
+ *
+ * \return TRUE if there are dirty cells, FALSE otherwise.
+ ****************************************************************************/
+int VdpShadowPending(void);
+
+/************************************************************************//**
+ * Send dirty cells of the RAM shadow to VRAM, using DMA. Up to
+ * VDP_SHADOW_FLUSH_MAX words are sent, remaining cells are sent on the
+ * following calls.
+ *
+ * \note The 68000 is halted during the DMA. Call this function during
+ * VBlank, where transfers are faster and do not disturb the display.
+ ****************************************************************************/
+void VdpShadowFlush(void);
+
+/************************************************************************//**
+ * Start clearing CRAM, VSRAM and VRAM, e.g. before booting a program.
+ *
+ * CRAM and VSRAM are cleared by the CPU. VRAM is cleared with a DMA fill
+ * running in the background, so other work (not accessing the VDP) can be
+ * done meanwhile. The plane shadow is not flushed anymore, until the next
+ * VdpInit() call.
+ *
+ * \warning Call VdpMemClearWait() before accessing the VDP again.
+ ****************************************************************************/
+void VdpMemClearStart(void);
+
+/************************************************************************//**
+ * Wait for the VRAM clear started by VdpMemClearStart() to complete, and
+ * clear the last VRAM word, that is not covered by the DMA fill.
+ ****************************************************************************/
+void VdpMemClearWait(void);
+
 /************************************************************************//**
  * Waits until the beginning of the next VBLANK cycle.
  ****************************************************************************/
@@ -437,6 +541,13 @@ void VdpDisable(void);
  ****************************************************************************/
 void VdpEnable(void);
 
+/************************************************************************//**
+ * Show the window plane on the bottom rows of the screen.
+ *
+ * \param[in] rows Number of cell rows to show (0 to hide the window).
+ ****************************************************************************/
+void VdpWinBottomSet(uint8_t rows);
+
 /************************************************************************//**
  * Waits until there is no DMA operation in progress. Useful only for VRAM
  * DMA copy and VRAM DMA fill operations, since 68k to VRAM copy freezes the
@@ -0,0 +1,42 @@
+#include "z80.h"
+
+/// Loop iterations keeping the reset line asserted, so the YM2612 resets
+#define Z80_RESET_LOOPS		32
+
+void z80_bus_req(void)
+{
+	Z80_REG_BUSREQ = 0x100;
+	while (Z80_REG_BUSREQ & 0x100);
+}
+
+void z80_load(uint16_t addr, const uint8_t *data, uint16_t len)
+{
+	volatile uint8_t *dst = Z80_RAM + addr;
+
+	// Bus is not granted while the Z80 is in reset
+	Z80_REG_RESET = 0x100;
+	z80_bus_req();
+	while (len--) {
+		*dst++ = *data++;
+	}
+}
+
+void z80_start(void)
+{
+	volatile uint16_t i;
+
+	Z80_REG_RESET = 0;
+	z80_bus_rel();
+	for (i = 0; i < Z80_RESET_LOOPS; i++);
+	Z80_REG_RESET = 0x100;
+}
+
+void z80_stop(void)
+{
+	volatile uint16_t i;
+
+	Z80_REG_RESET = 0;
+	z80_bus_rel();
+	for (i = 0; i < Z80_RESET_LOOPS; i++);
+}
+
@@ -0,0 +1,84 @@
+/************************************************************************//**
+ * \file
+ *
+ * \brief Z80 control from the 68000.
+ *
+ * \defgroup z80 z80
+ * \{
+ *
+ * \brief Z80 control from the 68000.
+ *
+ * The 68000 can only access the Z80 RAM while it owns the Z80 bus. Programs
+ * are loaded with the bus requested and the Z80 held in reset, and started
+ * by z80_start(). The Z80 reset line also resets the YM2612.
+ ****************************************************************************/
+
+#ifndef _Z80_H_
+#define _Z80_H_
+
+#include <stdint.h>
+
+/** \addtogroup Z80RegAddrs Z80RegAddrs
+ *  \brief Z80 related addresses.
+ *  \{ */
+/// Z80 RAM, as seen from the 68000
+#define Z80_RAM_ADDR		0xA00000
+/// Z80 bus request register
+#define Z80_REG_BUSREQ_ADDR	0xA11100
+/// Z80 reset register
+#define Z80_REG_RESET_ADDR	0xA11200
+/** \} */
+
+/// Z80 RAM length
+#define Z80_RAM_LEN		0x2000
+
+/// Z80 RAM, only accessible while the Z80 bus is owned
+#define Z80_RAM			((volatile uint8_t*)Z80_RAM_ADDR)
+
+/** \addtogroup Z80Regs Z80Regs
+ *  \brief Z80 control registers.
+ *  \{ */
+/// Z80 bus request register
+#define Z80_REG_BUSREQ		(*((volatile uint16_t*)Z80_REG_BUSREQ_ADDR))
+/// Z80 reset register
+#define Z80_REG_RESET		(*((volatile uint16_t*)Z80_REG_RESET_ADDR))
+/** \} */
+
+/************************************************************************//**
+ * \brief Request the Z80 bus, and wait until it is granted. The Z80 stops
+ * until the bus is released.
+ ****************************************************************************/
+void z80_bus_req(void);
+
+/************************************************************************//**
+ * \brief Release the Z80 bus, so the Z80 resumes execution.
+ ****************************************************************************/
+#define z80_bus_rel()	do{Z80_REG_BUSREQ = 0;}while(0)
+
+/************************************************************************//**
+ * \brief Copy a program to the Z80 RAM. The bus is requested, and kept
+ * requested on return, so more data can be copied to the Z80 RAM before
+ * starting the program with z80_start().
+ *
+ * \param[in] addr Z80 RAM address to copy the program to.
+ * \param[in] data Program to copy.
+ * \param[in] len  Length of the program in bytes.
+ ****************************************************************************/
+void z80_load(uint16_t addr, const uint8_t *data, uint16_t len);
+
+/************************************************************************//**
+ * \brief Reset the Z80 and release its bus, so it runs the loaded program
+ * from address 0.
+ ****************************************************************************/
+void z80_start(void);
+
+/************************************************************************//**
+ * \brief Stop the Z80, holding it (and the YM2612) in reset. The bus is
+ * released, as left by the startup code.
+ ****************************************************************************/
+void z80_stop(void);
+
+#endif /*_Z80_H_*/
+
+/** \} */
+
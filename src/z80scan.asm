@@ -0,0 +1,114 @@
+; Z80 flash scan program for the wflash bootloader
+BANK	equ 0x6000
+STACK	equ 0x2000
+; Entry point, runs from address 0 after reset
+	di
+	ld sp,STACK
+	jp start
+	org 0x08
+; Mailbox, parameters written by the 68000 before starting
+SC_MODE:	db 0
+SC_DONE:	db 0
+SC_BANK:	dw 0
+SC_OFF:	dw 0
+SC_REM:	db 0,0,0
+	db 0
+SC_SUM:	dw 0
+; Scan the range in chunks, up to the end of the bank window
+start:	ld hl,(SC_REM)
+	ld a,(SC_REM+2)
+	or h
+	or l
+	jp z,finish
+	ld de,(SC_BANK)
+	ld hl,BANK
+	ld b,9
+set_bank:	ld (hl),e
+	srl d
+	rr e
+	djnz set_bank
+	ld hl,(SC_OFF)
+	xor a
+	sub l
+	ld c,a
+	ld a,0
+	sbc a,h
+	ld b,a
+	ld a,(SC_REM+2)
+	or a
+	jr nz,chunk
+	ld hl,(SC_REM)
+	sbc hl,bc
+	jr nc,chunk
+	add hl,bc
+	ld b,h
+	ld c,l
+; BC bytes at window address HL
+chunk:	ld hl,(SC_OFF)
+	ld a,(SC_MODE)
+	or a
+	jr nz,wsum
+blank:	ld a,(hl)
+	inc a
+	jr nz,found
+	inc hl
+	dec bc
+	ld a,b
+	or c
+	jr nz,blank
+	jr nxt
+; 16-bit sum of big endian words, BC is even
+wsum:	srl b
+	rr c
+	ld a,c
+	ld c,b
+	ld b,a
+	or a
+	jr z,sum_go
+	inc c
+sum_go:	ld de,(SC_SUM)
+sum_w:	ld a,(hl)
+	inc l
+	add a,d
+	ld d,a
+	ld a,(hl)
+	inc hl
+	add a,e
+	ld e,a
+	jr nc,sum_nc
+	inc d
+sum_nc:	djnz sum_w
+	dec c
+	jr nz,sum_w
+	ld (SC_SUM),de
+; Chunk done, HL is 0 when the window end was reached
+nxt:	ld de,(SC_OFF)
+	ld (SC_OFF),hl
+	or a
+	sbc hl,de
+	ld b,h
+	ld c,l
+	ld hl,(SC_REM)
+	or a
+	sbc hl,bc
+	ld (SC_REM),hl
+	jr nc,win
+	ld hl,SC_REM+2
+	dec (hl)
+win:	ld hl,(SC_OFF)
+	ld a,h
+	or a
+	jp nz,start
+	ld h,0x80
+	ld (SC_OFF),hl
+	ld hl,(SC_BANK)
+	inc hl
+	ld (SC_BANK),hl
+	jp start
+; Non blank byte at HL
+found:	ld (SC_OFF),hl
+	ld a,2
+	jr done
+finish:	ld a,1
+done:	ld (SC_DONE),a
+	halt
@@ -0,0 +1,116 @@
+/* Z80 flash scan program: blank check and checksum of a cartridge  */
+/* range, read through the Z80 bank window, so the 68000 is free to */
+/* service the UART meanwhile.                                       */
+/*                                                                   */
+/* Assembled from z80scan.asm by tool/z80asm.py (run by make). The  */
+/* mailbox is part of the image, it is filled by z80scan_start()     */
+/* before releasing the Z80 reset. Addresses match the SC_ labels.   */
+
+#include "z80scan.h"
+#include "z80.h"
+#include "util.h"
+
+/// Z80 bank window start address
+#define Z80SCAN_WIN_ADDR	0x8000
+/// Z80 bank window length, flash addresses are banked in this size
+#define Z80SCAN_WIN_LEN		0x8000
+
+/** \addtogroup Z80ScanMbox Z80ScanMbox
+ *  \brief Mailbox fields, as Z80 RAM addresses. Multi-byte fields are
+ *  little endian.
+ *  \{ */
+/// Scan mode, see enum z80scan_mode
+#define Z80SCAN_MB_MODE		0x08
+/// Scan status, see enum z80scan_stat
+#define Z80SCAN_MB_DONE		0x09
+/// Bank of the next byte to scan
+#define Z80SCAN_MB_BANK		0x0A
+/// Window address of the next byte to scan, or of the non blank byte
+#define Z80SCAN_MB_OFF		0x0C
+/// Bytes remaining to scan, 24-bit
+#define Z80SCAN_MB_REM		0x0E
+/// Sum of the scanned words
+#define Z80SCAN_MB_SUM		0x12
+/** \} */
+
+/// Status written by the program when it halts
+enum z80scan_stat {
+	Z80SCAN_STAT_RUN = 0,	///< Scan in progress
+	Z80SCAN_STAT_END,	///< Range end reached
+	Z80SCAN_STAT_FOUND	///< Non blank byte found
+};
+
+static const uint8_t z80scan_prg[] ROM_DATA(z80scan_prg) = {
+#include "z80scan.inc"
+};
+
+/// Start and length of the range being scanned
+static uint32_t start, length;
+
+static uint32_t mbox_get(uint16_t addr, uint8_t len)
+{
+	uint32_t val = 0;
+
+	while (len--) {
+		val = (val<<8) | Z80_RAM[addr + len];
+	}
+
+	return val;
+}
+
+static void mbox_put(uint16_t addr, uint8_t len, uint32_t val)
+{
+	while (len--) {
+		Z80_RAM[addr++] = val;
+		val >>= 8;
+	}
+}
+
+void z80scan_start(enum z80scan_mode mode, uint32_t addr, uint32_t len)
+{
+	start = addr;
+	length = len;
+	z80_load(0, z80scan_prg, sizeof(z80scan_prg));
+	Z80_RAM[Z80SCAN_MB_MODE] = mode;
+	mbox_put(Z80SCAN_MB_BANK, 2, addr / Z80SCAN_WIN_LEN);
+	mbox_put(Z80SCAN_MB_OFF, 2, Z80SCAN_WIN_ADDR +
+			(addr & (Z80SCAN_WIN_LEN - 1)));
+	mbox_put(Z80SCAN_MB_REM, 3, len);
+	z80_start();
+}
+
+int z80scan_poll(uint32_t *done)
+{
+	uint8_t stat;
+	uint32_t rem;
+
+	// The Z80 stops while the mailbox is read, keep it short
+	z80_bus_req();
+	stat = Z80_RAM[Z80SCAN_MB_DONE];
+	rem = mbox_get(Z80SCAN_MB_REM, 3);
+	z80_bus_rel();
+
+	if (done) {
+		*done = length - rem;
+	}
+
+	return Z80SCAN_STAT_RUN != stat;
+}
+
+uint32_t z80scan_result(void)
+{
+	uint32_t result;
+
+	z80_bus_req();
+	if (Z80SCAN_MODE_SUM == Z80_RAM[Z80SCAN_MB_MODE]) {
+		result = mbox_get(Z80SCAN_MB_SUM, 2);
+	} else if (Z80SCAN_STAT_FOUND == Z80_RAM[Z80SCAN_MB_DONE]) {
+		result = mbox_get(Z80SCAN_MB_BANK, 2) * Z80SCAN_WIN_LEN +
+			(mbox_get(Z80SCAN_MB_OFF, 2) & (Z80SCAN_WIN_LEN - 1));
+	} else {
+		result = start + length;
+	}
+	z80_stop();
+
+	return result;
+}
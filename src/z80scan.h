@@ -0,0 +1,65 @@
+/************************************************************************//**
+ * \file
+ *
+ * \brief Cartridge flash scans run by the Z80.
+ *
+ * \defgroup z80scan z80scan
+ * \{
+ *
+ * \brief Cartridge flash scans run by the Z80.
+ *
+ * A small Z80 program reads a cartridge range through the Z80 bank window,
+ * checking it is blank or adding its words. The Z80 steals bus cycles from
+ * the 68000 instead of using its time, so the 68000 keeps servicing the
+ * loop and the UART while the scan runs. Progress and results are read from
+ * a mailbox in the Z80 RAM.
+ *
+ * The scan program replaces whatever the Z80 was running (the sound driver
+ * must be stopped before starting a scan), and the flash must be readable
+ * until the scan ends.
+ ****************************************************************************/
+
+#ifndef _Z80SCAN_H_
+#define _Z80SCAN_H_
+
+#include <stdint.h>
+
+/// Scan modes
+enum z80scan_mode {
+	Z80SCAN_MODE_BLANK = 0,	///< Find the first byte not equal to 0xFF
+	Z80SCAN_MODE_SUM	///< 16-bit sum of big endian words
+};
+
+/************************************************************************//**
+ * \brief Load the scan program and start scanning a range.
+ *
+ * \param[in] mode Scan mode.
+ * \param[in] addr Start address of the range. Must be even for
+ *            Z80SCAN_MODE_SUM.
+ * \param[in] len  Length of the range, up to 16 MiB. Must be even for
+ *            Z80SCAN_MODE_SUM.
+ ****************************************************************************/
+void z80scan_start(enum z80scan_mode mode, uint32_t addr, uint32_t len);
+
+/************************************************************************//**
+ * \brief Check the progress of the scan.
+ *
+ * \param[out] done Bytes scanned so far. Can be NULL.
+ *
+ * \return TRUE if the scan has finished, FALSE otherwise.
+ ****************************************************************************/
+int z80scan_poll(uint32_t *done);
+
+/************************************************************************//**
+ * \brief Get the result of a finished scan, and stop the Z80.
+ *
+ * \return For Z80SCAN_MODE_BLANK, the address of the first non blank byte,
+ * or the end of the range if it is blank. For Z80SCAN_MODE_SUM, the sum of
+ * the words in the range.
+ ****************************************************************************/
+uint32_t z80scan_result(void);
+
+#endif /*_Z80SCAN_H_*/
+
+/** \} */
+
@@ -0,0 +1,201 @@
+#!/usr/bin/env python3
+"""Assemble a Z80 program to a C array initializer.
+
+Usage: z80asm.py <source.asm> <output.inc>
+
+Two pass assembler for the Z80 instruction subset used by the wflash Z80
+programs (sound driver and flash scan program). Supports labels, equ, org,
+db, dw and ds. Expressions are evaluated as Python expressions, with $ as
+the current address.
+
+The output is the body of a C array initializer, one line per source line,
+with the address and the source instruction as a comment, to be included
+from the C file defining the array.
+"""
+import re
+import sys
+
+R = {'b':0,'c':1,'d':2,'e':3,'h':4,'l':5,'(hl)':6,'a':7}
+RR = {'bc':0,'de':1,'hl':2,'sp':3}
+RRP = {'bc':0,'de':1,'hl':2,'af':3}
+CC = {'nz':0,'z':1,'nc':2,'c':3,'po':4,'pe':5,'p':6,'m':7}
+ALU = {'add':0,'adc':1,'sub':2,'sbc':3,'and':4,'xor':5,'or':6,'cp':7}
+ROT = {'rlc':0,'rrc':1,'rl':2,'rr':3,'sla':4,'sra':5,'srl':7}
+IDX = re.compile(r'^\((ix|iy)\s*([+-].*)?\)$')
+
+class Asm:
+    def __init__(s): s.sym = {}
+    def val(s, e, final):
+        e = e.strip()
+        try:
+            return eval(re.sub(r'\$', str(s.pc), e), {}, s.sym)
+        except NameError:
+            if final: raise
+            return 0
+    def idx(s, o, final):
+        m = IDX.match(o)
+        if not m: return None
+        d = s.val(m.group(2), final) if m.group(2) else 0
+        return (0xDD if m.group(1)=='ix' else 0xFD, d & 0xff)
+    def enc(s, mn, ops, final):
+        v = lambda e: s.val(e, final)
+        n8 = lambda e: v(e) & 0xff
+        n16 = lambda e: [v(e) & 0xff, (v(e) >> 8) & 0xff]
+        def rel(e):
+            d = v(e) - (s.pc + 2)
+            if final and not -128 <= d <= 127: raise Exception('jr range %s' % e)
+            return d & 0xff
+        o = ops
+        if mn == 'nop': return [0]
+        if mn == 'di': return [0xF3]
+        if mn == 'ei': return [0xFB]
+        if mn == 'halt': return [0x76]
+        if mn == 'im': return [0xED, 0x56]
+        if mn in ('rlca','rrca','rla','rra'):
+            return [{'rlca':7,'rrca':0xF,'rla':0x17,'rra':0x1F}[mn]]
+        if mn == 'ex': return [0xEB]
+        if mn == 'ret':
+            return [0xC0 | CC[o[0]] << 3] if o else [0xC9]
+        if mn in ('jp','call'):
+            if len(o) == 2:
+                return [(0xC2 if mn=='jp' else 0xC4) | CC[o[0]] << 3] + n16(o[1])
+            return [0xC3 if mn=='jp' else 0xCD] + n16(o[0])
+        if mn == 'jr':
+            if len(o) == 2: return [0x20 | CC[o[0]] << 3, rel(o[1])]
+            return [0x18, rel(o[0])]
+        if mn == 'djnz': return [0x10, rel(o[0])]
+        if mn in ('push','pop'):
+            base = 0xC5 if mn=='push' else 0xC1
+            if o[0] in ('ix','iy'):
+                return [0xDD if o[0]=='ix' else 0xFD, base | 0x20]
+            return [base | RRP[o[0]] << 4]
+        if mn in ROT: return [0xCB, ROT[mn] << 3 | R[o[0]]]
+        if mn == 'bit': return [0xCB, 0x40 | v(o[0]) << 3 | R[o[1]]]
+        if mn in ('inc','dec'):
+            x = o[0]
+            if x in R: return [(4 if mn=='inc' else 5) | R[x] << 3]
+            if x in RR: return [(3 if mn=='inc' else 0xB) | RR[x] << 4]
+            if x in ('ix','iy'):
+                return [0xDD if x=='ix' else 0xFD, 0x23 if mn=='inc' else 0x2B]
+            p, d = s.idx(x, final)
+            return [p, 0x34 if mn=='inc' else 0x35, d]
+        if mn == 'sbc' and o[0] == 'hl': return [0xED, 0x42 | RR[o[1]] << 4]
+        if mn in ALU:
+            if len(o) == 2:
+                if o[0] == 'hl': return [0x09 | RR[o[1]] << 4]
+                if o[0] in ('ix','iy'):
+                    pre = 0xDD if o[0]=='ix' else 0xFD
+                    r = {'bc':0,'de':1,o[0]:2,'sp':3}[o[1]]
+                    return [pre, 0x09 | r << 4]
+                assert o[0] == 'a'
+                o = o[1:]
+            x = o[0]; op = ALU[mn]
+            if x in R: return [0x80 | op << 3 | R[x]]
+            i = s.idx(x, final)
+            if i: return [i[0], 0x86 | op << 3, i[1]]
+            return [0xC6 | op << 3, n8(x)]
+        if mn == 'ld':
+            a, b = o
+            if a in R and b in R: return [0x40 | R[a] << 3 | R[b]]
+            if a == 'a' and b == '(de)': return [0x1A]
+            if a == 'a' and b == '(bc)': return [0x0A]
+            if a == '(de)' and b == 'a': return [0x12]
+            if a == 'sp' and b not in ('hl','ix','iy'): return [0x31] + n16(b)
+            ia, ib = s.idx(a, final), s.idx(b, final)
+            if ib and a in R: return [ib[0], 0x46 | R[a] << 3, ib[1]]
+            if ia and b in R: return [ia[0], 0x70 | R[b], ia[1]]
+            if ia: return [ia[0], 0x36, ia[1], n8(b)]
+            if a in R: 
+                if b.startswith('('):
+                    assert a == 'a'; return [0x3A] + n16(b[1:-1])
+                return [0x06 | R[a] << 3, n8(b)]
+            if a.startswith('(') and b == 'a': return [0x32] + n16(a[1:-1])
+            if a.startswith('(') and b == 'hl': return [0x22] + n16(a[1:-1])
+            if a.startswith('(') and b in ('bc','de'): return [0xED, 0x43 | RR[b] << 4] + n16(a[1:-1])
+            if a in ('bc','de') and b.startswith('('): return [0xED, 0x4B | RR[a] << 4] + n16(b[1:-1])
+            if a == 'hl' and b.startswith('('): return [0x2A] + n16(b[1:-1])
+            if a in ('ix','iy'):
+                pre = 0xDD if a=='ix' else 0xFD
+                if b.startswith('('): return [pre, 0x2A] + n16(b[1:-1])
+                return [pre, 0x21] + n16(b)
+            if a in RR: return [0x01 | RR[a] << 4] + n16(b)
+        raise Exception('bad: %s %s' % (mn, o))
+
+    def run(s, lines, final):
+        s.pc = 0; out = {}; lst = []
+        for ln, line in enumerate(lines):
+            code = line.split(';')[0].rstrip()
+            if not code.strip(): 
+                lst.append((None, [], line)); continue
+            m = re.match(r'^(\w+):\s*(.*)$', code.strip())
+            if m and not code[0].isspace():
+                s.sym[m.group(1)] = s.pc
+                code = ' ' + m.group(2)
+                if not m.group(2).strip():
+                    lst.append((s.pc, [], line)); continue
+            m = re.match(r'^(\w+)\s+equ\s+(.*)$', code.strip())
+            if m:
+                s.sym[m.group(1)] = s.val(m.group(2), final)
+                lst.append((None, [], line)); continue
+            parts = code.strip().split(None, 1)
+            mn = parts[0].lower()
+            ops = [x.strip() for x in parts[1].split(',')] if len(parts) > 1 else []
+            ops_l = [x.lower() if not re.search(r'[A-Z_]{2,}', x) else x for x in ops]
+            addr = s.pc
+            if mn == 'org':
+                t = s.val(ops[0], final)
+                if final and t < s.pc: raise Exception('org overlap')
+                b = [0] * (t - s.pc)
+            elif mn == 'db': b = [s.val(x, final) & 0xff for x in ops]
+            elif mn == 'dw':
+                b = []
+                for x in ops: b += [s.val(x, final) & 0xff, (s.val(x, final) >> 8) & 0xff]
+            elif mn == 'ds': b = [0] * s.val(ops[0], final)
+            else: b = s.enc(mn, ops_l, final)
+            for i, x in enumerate(b): out[addr + i] = x
+            s.pc += len(b)
+            lst.append((addr, b, line))
+        return out, lst
+
+def assemble(src):
+    a = Asm()
+    lines = open(src).read().split('\n')
+    a.run(lines, False); a.run(lines, False)
+    out, lst = a.run(lines, True)
+    n = max(out) + 1 if out else 0
+    return bytes(out.get(i, 0) for i in range(n)), lst, a.sym
+
+def initializer(src):
+    blob, lst, sym = assemble(src)
+    lines = ['\t// Generated from %s by tool/z80asm.py, do not edit'
+            % src.split('/')[-1]]
+    for addr, by, line in lst:
+        code = line.split(';')[0].rstrip()
+        com = line.split(';', 1)[1].strip() if ';' in line else ''
+        m = re.match(r'^(\w+):\s*(.*)$', code)
+        if m: code = m.group(1) + ': ' + m.group(2).strip()
+        else: code = code.strip()
+        code = re.sub(r'\s+', ' ', code)
+        if not by:
+            if com and not code: lines.append('\t// ' + com)
+            elif code and addr is None: lines.append('\t// ' + code)
+            elif code: lines.append('\t// %04X %s' % (addr, code))
+            continue
+        for i in range(0, len(by), 8):
+            hexs = ''.join('0x%02X,' % x for x in by[i:i+8])
+            if com and i == 0:
+                lines.append('\t// ' + com)
+            if i == 0:
+                pad = 40 - len(hexs)
+                tabs = '\t' * max(1, pad // 8 + (1 if pad % 8 else 0))
+                lines.append('\t%s%s// %04X %s' % (hexs, tabs, addr, code))
+            else:
+                lines.append('\t' + hexs)
+    return '\n'.join(lines).rstrip(',') + '\n'
+
+if __name__ == '__main__':
+    if len(sys.argv) != 3:
+        sys.exit('usage: %s <source.asm> <output.inc>' % sys.argv[0])
+    out = initializer(sys.argv[1])
+    with open(sys.argv[2], 'w') as f:
+        f.write(out)